@@ -3,6 +3,12 @@
 #include <string>
 #include <unordered_set>
 #include <vector>
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
 
 namespace TMUtil
 {
@@ -20,16 +26,132 @@ namespace TMUtil
 		return result;
 	}
 
+	// same result as strtod, which spends most of its time on locale handling: short decimals, as vector components
+	// usually are, are exact integers scaled by an exact power of ten, so one correctly rounded multiply or divide
+	// gives the correctly rounded value; anything longer or unusual is left to strtod
+	const char* parseDouble(const char *begin, double &value)
+	{
+		static const double powers[] = {
+				1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+				1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+			};
+		auto isDigit = [](char c) { return c >= '0' && c <= '9'; };
+
+		const char *cursor = begin;
+		while (isspace((unsigned char)*cursor))
+			++cursor;
+		const bool negative = *cursor == '-';
+		if (*cursor == '-' || *cursor == '+')
+			++cursor;
+
+		uint64_t mantissa = 0;
+		int digits = 0, exponent = 0;
+		bool any = false;
+		for (; isDigit(*cursor); ++cursor)
+		{
+			any = true;
+			digits += mantissa || *cursor != '0';
+			mantissa = mantissa * 10 + (*cursor - '0');
+		}
+		if (*cursor == '.')
+		{
+			for (++cursor; isDigit(*cursor); ++cursor, --exponent)
+			{
+				any = true;
+				digits += mantissa || *cursor != '0';
+				mantissa = mantissa * 10 + (*cursor - '0');
+			}
+		}
+		if ((*cursor == 'e' || *cursor == 'E') && any)
+		{
+			const char *exponent_start = ++cursor;
+			const bool negative_exponent = *cursor == '-';
+			if (*cursor == '-' || *cursor == '+')
+				++cursor;
+
+			int written_exponent = 0;
+			for (; isDigit(*cursor) && written_exponent < 1000; ++cursor)
+				written_exponent = written_exponent * 10 + (*cursor - '0');
+			if (cursor == exponent_start || !isDigit(cursor[-1]))
+				any = false;
+			exponent += negative_exponent ? -written_exponent : written_exponent;
+		}
+
+		if (!any || digits > 19 || mantissa > (1ull << 53) || exponent < -22 || exponent > 22
+		|| isalnum((unsigned char)*cursor) || *cursor == '.')
+		{
+			char *end;
+			value = strtod(begin, &end);
+			return end;
+		}
+
+		value = exponent < 0 ? mantissa / powers[-exponent] : mantissa * powers[exponent];
+		if (negative)
+			value = -value;
+		return cursor;
+	}
+
+	// parses "[a,b,...]" straight into out, which must hold size values, without building any intermediate strings;
+	// anything else, a missing bracket or a trailing comma included, is rejected
+	void parseJSONVector(const std::string &s, double *out, const int size)
+	{
+		if (s.size() < 2 || s.front() != '[' || s.back() != ']')
+			throw std::invalid_argument("parseJSONVector: " + s);
+
+		const char *cursor = s.c_str() + 1, *end = s.c_str() + s.size() - 1;
+		int count = 0;
+		while (cursor < end)
+		{
+			double value;
+			const char *parsed = parseDouble(cursor, value);
+			if (parsed == cursor || count == size)
+				throw std::invalid_argument("parseJSONVector: " + s);
+			out[count++] = value;
+
+			for (cursor = parsed; cursor < end && isspace((unsigned char)*cursor); ++cursor);
+			if (cursor < end && (*cursor++ != ',' || cursor == end))
+				throw std::invalid_argument("parseJSONVector: " + s);
+		}
+
+		if (count != size)
+			throw std::invalid_argument("parseJSONVector: " + s);
+	}
+
 	std::vector<double> parseJSONVector(const std::string &s, const int size)
 	{
-		std::istringstream iss(s.substr(1, s.size()-2));
-		std::vector<double> result;
-		result.reserve(size);
-		for (std::string token; std::getline(iss, token, ','); )
+		std::vector<double> result(size);
+		parseJSONVector(s, result.data(), size);
+		return result;
+	}
+
+	// parses a packed little-endian float32 or float64 vector, telling the two apart by its length
+	std::vector<double> parseBlobVector(const std::string &s, const int size)
+	{
+		std::vector<double> result(size);
+		const bool doubles = s.size() == size * sizeof(double);
+		if (!doubles && s.size() != size * sizeof(float))
+			throw std::invalid_argument("parseBlobVector: " + std::to_string(s.size()) + " bytes");
+
+		const size_t width = doubles ? sizeof(double) : sizeof(float);
+		for (auto i = 0; i < size; ++i)
 		{
-			result.push_back(stod(token));
+			char bytes[sizeof(double)];
+			memcpy(bytes, s.data() + i * width, width);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+			std::reverse(bytes, bytes + width);
+#endif
+			if (doubles)
+			{
+				memcpy(&result[i], bytes, sizeof(double));
+			}
+			else
+			{
+				float value;
+				memcpy(&value, bytes, sizeof(float));
+				result[i] = value;
+			}
 		}
 
 		return result;
 	}
-}
\ No newline at end of file
+}
@@ -0,0 +1,1540 @@
+// microbenchmarks for pericog's hot paths, run on synthetic tweets shaped like the real stream so they need no database
+// and no model: feature vectors clustered around topics, words drawn from a Zipf distribution with mentions, links and
+// non-ASCII mixed in, and locations bunched around hot spots inside the [grid] box
+//
+// usage: bench [config] [tweets]
+// parameters come from the [grid], [tokens2vec], [optics], [optimization] and [scheduler] sections of the config, and everything
+// random is seeded, so the same config and tweet count always measure the same work; the checksums only change when
+// the results do
+#include <string>
+#include <vector>
+#include <sstream>
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <random>
+#include <regex>
+#include <set>
+#include <tuple>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <cctype>
+#include <cassert>
+#include <sys/resource.h>
+
+using namespace std;
+
+#include "INIReader.h"
+#include "distance.h"
+#include "dictionary.h"
+#include "index.h"
+#include "thread_pool.h"
+#include "optics.h"
+#include "clusters.h"
+#include "scheduler.h"
+#include "shards.h"
+#include "snapshot.h"
+#include "window.h"
+#include "tweet.h"
+#include "util.h"
+
+Tweet* Tweet::delimiter;
+unsigned int Tweet::variant_count = 0;
+
+const unsigned int
+	SEED = 0x7415,
+	REPETITIONS = 5,
+	START = 1500000000,
+	PERIOD = 300,
+	PERIODS = 3,
+	MIN_TWEETS = 3,
+	TOPICS = 32,
+	HOT_SPOTS = 12,
+	VOCABULARY = 20000,
+	USERS = 5000,
+	DISTANCE_SAMPLE = 2000,
+	CORE_SAMPLE = 256, // of the distance sample, standing in for cluster cores
+	CORE_ROWS = 16, // tweets per block, as findNeighbors takes them
+	LARGE_WINDOW = 1000000, // tweets in the window the OPTICS passes are timed on
+	LARGE_DEGREE = 16, // neighbors of each of them
+	LARGE_SPREAD = 200, // how far apart in the window neighbors can be
+	REPLAY_PERIODS = 24,
+	REPLAY_HISTORY = 4, // periods in the replay's window
+	REPLAY_REPEATS = 5, // replays every period's cost is the median of
+	BURST_START = 8,
+	BURST_PERIODS = 2,
+	BURST = 3; // times the usual rate
+
+// the share of every period the usual rate keeps pericog busy for in the replay
+const double LOAD = .5;
+
+struct Config
+{
+	double west, east, south, north, cell_size, regional_radius;
+	double epsilon, reachability_minimum, reachability_maximum, degrade_lag, recover_lag;
+	unsigned int vector_size, minimum_points, thread_count, lsh_tables, lsh_bits, candidate_cap, max_skipped;
+	bool circular, morton, quantized;
+};
+
+struct SyntheticTweet
+{
+	unsigned int time;
+	double lat, lon;
+	string text, user, json_vector, blob_vector;
+	vector<double> feature_vector;
+};
+
+// everything generated comes from one seeded generator, in one fixed order
+class Generator
+{
+	mt19937 random;
+	vector<string> words;
+	discrete_distribution<unsigned int> word_distribution, topic_distribution;
+	vector<vector<unsigned int>> topic_words;
+	vector<pair<double, double>> hot_spots;
+
+	string makeWord();
+	double uniform(double low, double high);
+
+public:
+	vector<vector<double>> topics;
+
+	Generator(const Config &config);
+	vector<SyntheticTweet> generate(const Config &config, size_t count);
+};
+
+Generator::Generator(const Config &config)
+	: random(SEED)
+{
+	vector<double> weights;
+	for (auto i = 0u; i < VOCABULARY; ++i)
+	{
+		words.push_back(makeWord());
+		weights.push_back(1.0 / (i + 1));
+	}
+	word_distribution = discrete_distribution<unsigned int>(weights.begin(), weights.end());
+	weights.resize(TOPICS);
+	topic_distribution = discrete_distribution<unsigned int>(weights.begin(), weights.end());
+
+	normal_distribution<double> normal;
+	topics.assign(TOPICS, vector<double>(config.vector_size));
+	topic_words.resize(TOPICS);
+	for (auto i = 0u; i < TOPICS; ++i)
+	{
+		for (auto &component : topics[i])
+			component = normal(random);
+
+		// topics are named by mid-frequency words, the most common ones are shared by everything
+		for (auto j = 0u; j < 4; ++j)
+			topic_words[i].push_back(100 + random() % (VOCABULARY / 4));
+	}
+
+	for (auto i = 0u; i < HOT_SPOTS; ++i)
+		hot_spots.emplace_back(uniform(config.south, config.north), uniform(config.west, config.east));
+}
+
+double Generator::uniform(double low, double high)
+{
+	return uniform_real_distribution<double>(low, high)(random);
+}
+
+string Generator::makeWord()
+{
+	string word;
+	const auto length = 2 + random() % 9;
+	for (auto i = 0u; i < length; ++i)
+		word += (char)('a' + random() % 26);
+	return word;
+}
+
+vector<SyntheticTweet> Generator::generate(const Config &config, size_t count)
+{
+	normal_distribution<double> normal;
+	vector<SyntheticTweet> tweets(count);
+	for (auto &tweet : tweets)
+	{
+		tweet.time = START + random() % (PERIODS * PERIOD);
+		tweet.user = "user" + to_string(random() % USERS);
+
+		// most tweets are about a topic and sent from near where it is happening, the rest are noise from anywhere
+		const bool on_topic = random() % 5;
+		const auto topic = topic_distribution(random);
+		if (on_topic)
+		{
+			const auto &spot = hot_spots[topic % HOT_SPOTS];
+			tweet.lat = spot.first + normal(random) * config.regional_radius / 2;
+			tweet.lon = spot.second + normal(random) * config.regional_radius / 2;
+		}
+		else
+		{
+			tweet.lat = uniform(config.south, config.north);
+			tweet.lon = uniform(config.west, config.east);
+		}
+		tweet.lat = min(max(tweet.lat, config.south), config.north - config.cell_size / 2);
+		tweet.lon = min(max(tweet.lon, config.west), config.east - config.cell_size / 2);
+
+		const double spread = uniform(.3, .7);
+		tweet.feature_vector.resize(config.vector_size);
+		for (auto i = 0u; i < config.vector_size; ++i)
+		{
+			// vectors come out of the model as float32
+			tweet.feature_vector[i] = (float)(on_topic ? topics[topic][i] + normal(random) * spread : normal(random));
+		}
+
+		const auto length = 6 + random() % 15;
+		for (auto i = 0u; i < length; ++i)
+		{
+			string word = on_topic && random() % 4 == 0
+				? words[topic_words[topic][random() % topic_words[topic].size()]]
+				: words[word_distribution(random)];
+			switch (random() % 40)
+			{
+				case 0: word = "@" + word; break;
+				case 1: word = "https://t.co/" + word; break;
+				case 2: word = "#" + word; break;
+				case 3: word[0] = toupper(word[0]); break;
+				case 4: word += "!"; break;
+				case 5: word += ","; break;
+				case 6: word += "\xC3\xA9"; break; // é
+				case 7: word = "\xF0\x9F\x94\xA5" + word; break; // an emoji
+			}
+			tweet.text += (i ? " " : "") + word;
+		}
+
+		char component[32];
+		tweet.json_vector = "[";
+		for (auto i = 0u; i < config.vector_size; ++i)
+		{
+			snprintf(component, sizeof(component), "%.9g", tweet.feature_vector[i]);
+			tweet.json_vector += (i ? "," : "") + string(component);
+		}
+		tweet.json_vector += "]";
+
+		for (const auto &value : tweet.feature_vector)
+		{
+			const float single = value;
+			tweet.blob_vector.append((const char*)&single, sizeof(single));
+		}
+	}
+
+	// tweets arrive in time order
+	stable_sort(tweets.begin(), tweets.end(), [](const SyntheticTweet &a, const SyntheticTweet &b) { return a.time < b.time; });
+	return tweets;
+}
+
+// runs body repetitions times, calling setup untimed before each run, and prints the median and fastest time per item;
+// body returns a checksum of what it computed, which keeps the work from being optimized away
+void run(const string &name, size_t items, function<double()> body, function<void()> setup = [](){}, unsigned int repetitions = REPETITIONS)
+{
+	vector<double> seconds;
+	double checksum = 0;
+	for (auto i = 0u; i < repetitions; ++i)
+	{
+		setup();
+		const auto start = chrono::steady_clock::now();
+		checksum = body();
+		seconds.push_back(chrono::duration<double>(chrono::steady_clock::now() - start).count());
+	}
+	sort(seconds.begin(), seconds.end());
+
+	const double median = seconds[seconds.size() / 2], per_item = items ? median / items : median;
+	cout << left << setw(32) << name << right
+		<< setw(10) << items
+		<< setw(14) << fixed << setprecision(1) << per_item * 1e9
+		<< setw(14) << (items ? seconds[0] / items : seconds[0]) * 1e9
+		<< setw(14) << setprecision(0) << (median > 0 ? items / median : 0)
+		<< "   " << defaultfloat << setprecision(10) << checksum << endl;
+}
+
+void fillRandom(vector<double> &values, mt19937 &random)
+{
+	normal_distribution<double> normal;
+	for (auto &value : values)
+		value = normal(random);
+}
+
+void fillRandom(vector<int8_t> &values, mt19937 &random)
+{
+	for (auto &value : values)
+		value = (int8_t)((int)(random() % 255) - 127);
+}
+
+// whether block gives every product exactly as kernel gives it a pair at a time, over random vectors of size; tiles
+// are cut off at both edges, and there are enough columns for more than one block
+template<class T, class Dot>
+bool blockMatches(void (*block)(const T* const *, unsigned int, const T* const *, unsigned int, unsigned int, Dot *),
+	Dot (*kernel)(const T*, const T*, unsigned int), unsigned int size, mt19937 &random)
+{
+	const unsigned int a_count = TMDistance::TILE_ROWS * 2 + 1,
+		b_count = TMDistance::BLOCK_BYTES / (sizeof(T) * size) + TMDistance::TILE_COLUMNS + 1;
+	vector<vector<T>> vectors(a_count + b_count, vector<T>(size));
+	vector<const T*> a, b;
+	for (auto i = 0u; i < vectors.size(); ++i)
+	{
+		fillRandom(vectors[i], random);
+		(i < a_count ? a : b).push_back(vectors[i].data());
+	}
+
+	vector<Dot> dots(a_count * b_count);
+	block(a.data(), a_count, b.data(), b_count, size, dots.data());
+	for (auto i = 0u; i < a_count; ++i)
+	{
+		for (auto j = 0u; j < b_count; ++j)
+		{
+			if (dots[i * b_count + j] != kernel(a[i], b[j], size))
+				return false;
+		}
+	}
+	return true;
+}
+
+// the words Tweet::clean found with regexes before TMTokenizer replaced them, to check the tokenizer against
+set<string> regexClean(const string &text)
+{
+	static const regex mentionsAndUrls("((\\B@)|(\\bhttps?:\\/\\/))[^\\s]+");
+	static const regex nonWord("[^\\w]+");
+
+	auto clean_text = regex_replace(regex_replace(text, mentionsAndUrls, " "), nonWord, " ");
+	transform(clean_text.begin(), clean_text.end(), clean_text.begin(), ::tolower);
+
+	set<string> words;
+	istringstream stream(clean_text);
+	for (string word; getline(stream, word, ' '); )
+	{
+		if (!word.empty())
+			words.insert(word);
+	}
+	return words;
+}
+
+// texts the tokenizer has to find the same words in as the regexes: every synthetic tweet, edge cases around markers,
+// whitespace and UTF-8, and random strings built out of the edge cases
+vector<string> tokenizerCases(const vector<SyntheticTweet> &sources)
+{
+	const vector<string> fragments = {
+		"@", "@@", "x@y", "http://", "https://", "http:/", "HTTPS://", "https://t.co/a", "a", "Word", "_", "9",
+		" ", "\t", "\n", "\v", "\f", "\r", "#", "!", ".", "-", "/",
+		"\xC3\xA9", // é
+		"\xC3\x89", // É
+		"\xE6\x9D\xB1", // a CJK ideograph
+		"\xF0\x9F\x94\xA5", // an emoji
+		"\xC2\xA0", // no-break space
+		"\xE3\x80\x80", // ideographic space
+		"\xFF", "\xC3", // a byte that is never UTF-8, a truncated character
+		"\xC0\xAF", // an overlong "/"
+		"\xED\xA0\x80", // a surrogate
+	};
+
+	vector<string> texts = {
+		"", "@", "https://", "@ user", "email@example.com", "RT @user: Hello, World!", "see https://t.co/x?y=1 now",
+		"caf\xC3\xA9 S\xC3\xA3o Paulo", "\xD0\x9F\xD1\x80\xD0\xB8\xD0\xB2\xD0\xB5\xD1\x82 world", "@jos\xC3\xA9 hola",
+		"na\xC3\xAFve@home", "\xC3\xA9@user", "\xF0\x9F\x94\xA5@fire", "\xF0\x9F\x94\xA5https://t.co/a", "x\xC2\xA0@y",
+		"\xE6\x9D\xB1\xE4\xBA\xAC", "snake_case CamelCase 123abc", "\t\vtabs\fand\rreturns\n",
+	};
+	for (const auto &source : sources)
+		texts.push_back(source.text);
+
+	mt19937 random(SEED);
+	for (auto i = 0u; i < 100000; ++i)
+	{
+		string text;
+		for (auto length = 1 + random() % 12; length--; )
+			text += fragments[random() % fragments.size()];
+		texts.push_back(text);
+	}
+	return texts;
+}
+
+// every tweet in the region, the exact search both indexes narrow down; only for measuring their recall
+class RegionIndex : public NeighborIndex
+{
+public:
+	RegionIndex(CellGrid &grid) : NeighborIndex(grid) {}
+	void insert(Tweet* tweet)
+	{
+		if (!grid.contains(tweet))
+			return;
+		lock_guard<mutex> lock(getCellLock(tweet));
+		grid.getCell(tweet).tweets_by_hash[0].insert(tweet);
+	}
+	void erase(Tweet* tweet)
+	{
+		if (!grid.contains(tweet))
+			return;
+		lock_guard<mutex> lock(getCellLock(tweet));
+		auto &tweets_by_hash = grid.getCell(tweet).tweets_by_hash;
+		tweets_by_hash[0].erase(tweet);
+		if (tweets_by_hash[0].empty())
+			tweets_by_hash.erase(0);
+		grid.releaseCell(tweet);
+	}
+	void query(const Tweet* tweet, vector<Tweet*> &candidates) const
+	{
+		grid.forRegion(tweet, [&](const Cell &cell) {
+			const auto tweets = cell.tweets_by_hash.find(0);
+			if (tweets != cell.tweets_by_hash.end())
+				candidates.insert(candidates.end(), tweets->second.begin(), tweets->second.end());
+		});
+	}
+};
+
+enum IndexType { WORD_INDEX, LSH_INDEX, REGION_INDEX };
+
+// the median smallest reachability distance of the tweets reachable within epsilon
+double getMedianReachability(const Window &window, double epsilon)
+{
+	vector<double> distances;
+	for (const auto &slice : window.getSlices())
+	{
+		for (const auto &tweet : slice.second->tweets)
+		{
+			if (tweet->smallest_reachability_distance <= epsilon)
+				distances.push_back(tweet->smallest_reachability_distance);
+		}
+	}
+	if (distances.empty())
+		return epsilon;
+	nth_element(distances.begin(), distances.begin() + distances.size() / 2, distances.end());
+	return distances[distances.size() / 2];
+}
+
+// the sequences of the tweets, in order, to compare results held by different tweets
+vector<unsigned long long> getSequences(const vector<Tweet*> &tweets)
+{
+	vector<unsigned long long> sequences;
+	for (const auto &tweet : tweets)
+		sequences.push_back(tweet->sequence);
+	return sequences;
+}
+
+// the clustering state pericog keeps between periods
+struct State
+{
+	const Config &config;
+	TMDistance::DotProduct dotProduct;
+	TMDistance::QuantizedDotProduct quantizedDotProduct; // null unless candidates are screened
+	TMDistance::DotProductBlock dotProductBlock; // null when candidates are screened
+	TMDistance::QuantizedDotProductBlock quantizedDotProductBlock; // null unless candidates are screened
+	ThreadPool &pool;
+	Dictionary &dictionary;
+	vector<Tweet*> &cores;
+	CellGrid &grid;
+	unique_ptr<Window> window;
+	unique_ptr<NeighborIndex> index;
+	TMShards::Coordinator* shards = nullptr; // when set, its workers index and search the tweets instead of index
+	OpticsUpdater optics_updater;
+	unsigned long long sequence;
+	SearchCounts counts; // what search went through since the last reset
+
+	State(const Config &config, TMDistance::DotProduct dotProduct, TMDistance::QuantizedDotProduct quantizedDotProduct,
+		ThreadPool &pool, Dictionary &dictionary, vector<Tweet*> &cores, CellGrid &grid)
+		: config(config), dotProduct(dotProduct), quantizedDotProduct(quantizedDotProduct),
+		dotProductBlock(quantizedDotProduct ? nullptr : TMDistance::selectDotProductBlock(config.vector_size)),
+		quantizedDotProductBlock(quantizedDotProduct ? TMDistance::selectQuantizedDotProductBlock(config.vector_size) : nullptr),
+		pool(pool), dictionary(dictionary), cores(cores), grid(grid)
+	{}
+	~State();
+	void clear();
+	// an empty window and index
+	void reset(IndexType index_type);
+	// what findNeighbors does, linking both ways; the earlier tweets linked to are added to linked
+	void search(const vector<Tweet*> &tweets, unsigned int candidate_cap, vector<Tweet*> &linked);
+	// a new tweet indexed, unless the workers index it
+	void place(Tweet* tweet);
+	// what updateTweets does over a few periods, on one thread up to the optics update
+	void build(const vector<SyntheticTweet> &sources, IndexType index_type);
+	// every pair of tweets linked as neighbors, by sequence, cores left out
+	vector<pair<unsigned long long, unsigned long long>> getNeighborPairs() const;
+	// one whole period, with the arrivals spread over the period starting at start: what updateTweets does, on one
+	// thread up to the optics update, and getClusters if extract
+	void advance(const vector<const SyntheticTweet*> &arrivals, unsigned int start, unsigned int candidate_cap, bool extract);
+	// what getClusters does at the end of a period
+	void extract();
+};
+
+State::~State()
+{
+	clear();
+}
+
+void State::clear()
+{
+	if (window && !shards)
+	{
+		for (const auto &slice : window->getSlices())
+		{
+			for (const auto &tweet : slice.second->tweets)
+				index->erase(tweet);
+		}
+	}
+	// settle whatever is still queued while its tweets exist
+	optics_updater.update(pool, config.epsilon, config.minimum_points);
+	window.reset();
+	index.reset();
+
+	for (auto &core : cores)
+	{
+		core->optics_neighbors.clear();
+		core->core_distance = core->smallest_reachability_distance = INFINITY;
+	}
+}
+
+void State::reset(IndexType index_type)
+{
+	clear();
+	window.reset(new Window(PERIOD));
+	if (index_type == LSH_INDEX)
+		index.reset(new LshIndex(grid, dotProduct, config.vector_size, config.lsh_tables, config.lsh_bits));
+	else if (index_type == REGION_INDEX)
+		index.reset(new RegionIndex(grid));
+	else
+		index.reset(new WordIndex(grid));
+	sequence = cores.size();
+	counts = SearchCounts();
+}
+
+vector<pair<unsigned long long, unsigned long long>> State::getNeighborPairs() const
+{
+	vector<pair<unsigned long long, unsigned long long>> pairs;
+	for (const auto &slice : window->getSlices())
+	{
+		for (const auto &tweet : slice.second->tweets)
+		{
+			for (const auto &neighbor : tweet->optics_neighbors)
+			{
+				if (neighbor.tweet->sequence > cores.size() && neighbor.tweet->sequence < tweet->sequence)
+					pairs.emplace_back(neighbor.tweet->sequence, tweet->sequence);
+			}
+		}
+	}
+	sort(pairs.begin(), pairs.end());
+	return pairs;
+}
+
+void State::place(Tweet* tweet)
+{
+	if (shards)
+		return;
+	index->insert(tweet);
+	if (quantizedDotProduct)
+		tweet->quantize(config.vector_size);
+}
+
+void State::search(const vector<Tweet*> &tweets, unsigned int candidate_cap, vector<Tweet*> &linked)
+{
+	if (shards)
+	{
+		vector<vector<Neighbor>> found;
+		counts += shards->search(tweets, found, candidate_cap);
+		for (auto i = 0u; i < tweets.size(); ++i)
+		{
+			tweets[i]->optics_neighbors.swap(found[i]);
+			for (const auto &neighbor : tweets[i]->optics_neighbors)
+			{
+				neighbor.tweet->optics_neighbors.push_back(Neighbor{tweets[i], neighbor.distance});
+				linked.push_back(neighbor.tweet);
+			}
+		}
+		return;
+	}
+
+	vector<Tweet*> candidates;
+	CoreDistances core_distances(cores, dotProduct, dotProductBlock, quantizedDotProductBlock, config.vector_size);
+	for (auto begin = 0u; begin < tweets.size(); begin += CORE_ROWS)
+	{
+		const auto end = min<size_t>(begin + CORE_ROWS, tweets.size());
+		core_distances.compute(&tweets[begin], end - begin);
+		for (auto i = begin; i < end; ++i)
+		{
+			const auto &tweet = tweets[i];
+			searchNeighbors(tweet, i - begin, candidates, core_distances, *index, cores, dotProduct, quantizedDotProduct,
+				config.vector_size, config.epsilon, candidate_cap, tweet->optics_neighbors, counts);
+			for (const auto &neighbor : tweet->optics_neighbors)
+			{
+				neighbor.tweet->optics_neighbors.push_back(Neighbor{tweet, neighbor.distance});
+				linked.push_back(neighbor.tweet);
+			}
+		}
+	}
+}
+
+void State::build(const vector<SyntheticTweet> &sources, IndexType index_type)
+{
+	reset(index_type);
+
+	// one batch per period, sealed once it is over, as pericog sees them
+	vector<Tweet*> tweets, linked;
+	auto source = sources.begin();
+	for (auto period = 0u; period < PERIODS; ++period)
+	{
+		const unsigned int period_end = START + (period + 1) * PERIOD;
+		tweets.clear();
+		for (; source != sources.end() && source->time < period_end; ++source)
+		{
+			auto tweet = window->create(source->time, source->lat, source->lon, source->text, vector<double>(source->feature_vector));
+			tweet->user = source->user;
+			tweet->sequence = ++sequence;
+			tweet->clean(dictionary, config.cell_size);
+			if (tweet->words.empty() || !grid.contains(tweet))
+			{
+				window->discard(tweet);
+				continue;
+			}
+			place(tweet);
+			tweets.push_back(tweet);
+		}
+
+		search(tweets, 0, linked);
+		linked.clear();
+		for (const auto &tweet : tweets)
+			window->insert(tweet);
+		if (config.morton)
+		{
+			const auto moved = window->seal(period_end - 1, config.vector_size);
+			if (shards)
+				shards->seal(period_end - 1, moved);
+			else
+				index->relocate(moved);
+		}
+	}
+
+	tweets.clear();
+	for (const auto &slice : window->getSlices())
+		tweets.insert(tweets.end(), slice.second->tweets.begin(), slice.second->tweets.end());
+
+	for (const auto &core : cores)
+		core->sortNeighbors();
+	for (const auto &tweet : tweets)
+	{
+		tweet->sortNeighbors();
+		optics_updater.touch(tweet);
+	}
+	for (const auto &core : cores)
+		optics_updater.touch(core);
+	optics_updater.update(pool, config.epsilon, config.minimum_points);
+}
+
+void State::advance(const vector<const SyntheticTweet*> &arrivals, unsigned int start, unsigned int candidate_cap, bool extract)
+{
+	const auto expired_tweets = window->expire(start - REPLAY_HISTORY * PERIOD);
+	optics_updater.unlink(pool, expired_tweets);
+	if (shards)
+		shards->expire(start - REPLAY_HISTORY * PERIOD, expired_tweets);
+	else
+	{
+		for (const auto &tweet : expired_tweets)
+			index->erase(tweet);
+	}
+	window->releaseExpired();
+
+	vector<Tweet*> tweets, linked;
+	for (auto i = 0u; i < arrivals.size(); ++i)
+	{
+		const auto &source = *arrivals[i];
+		auto tweet = window->create(start + i * PERIOD / arrivals.size(), source.lat, source.lon, source.text, vector<double>(source.feature_vector));
+		tweet->user = source.user;
+		tweet->sequence = ++sequence;
+		tweet->clean(dictionary, config.cell_size);
+		if (tweet->words.empty() || !grid.contains(tweet))
+		{
+			window->discard(tweet);
+			continue;
+		}
+		place(tweet);
+		tweets.push_back(tweet);
+	}
+
+	search(tweets, candidate_cap, linked);
+	sort(linked.begin(), linked.end());
+	linked.erase(unique(linked.begin(), linked.end()), linked.end());
+	for (const auto &tweet : linked)
+	{
+		tweet->sortNeighbors();
+		optics_updater.touch(tweet);
+	}
+	for (const auto &tweet : tweets)
+	{
+		window->insert(tweet);
+		tweet->sortNeighbors();
+		optics_updater.touch(tweet);
+	}
+	optics_updater.update(pool, config.epsilon, config.minimum_points);
+	if (config.morton)
+	{
+		const auto moved = window->seal(start + PERIOD - 1, config.vector_size);
+		if (shards)
+			shards->seal(start + PERIOD - 1, moved);
+		else
+			index->relocate(moved);
+	}
+
+	if (extract)
+		this->extract();
+}
+
+void State::extract()
+{
+	getClusters(*window, cores, config.epsilon, config.reachability_minimum, config.reachability_maximum, MIN_TWEETS, &pool);
+}
+
+// replays the tweets as a stream that runs at BURST times its usual rate for a few periods, on a simulated clock that
+// charges every period for as long as it takes, scaled so the usual rate keeps pericog busy for LOAD of a period;
+// prints how late each period starts running in full, and running degraded as [scheduler] says
+//
+// both runs are charged from the same measurements: each period is timed in full on one state and degraded on the
+// other, back to back, and charged the median over REPLAY_REPEATS replays, so noise between runs cannot decide which
+// catches up first; a degraded period is charged what it took on the state that was always degraded, which only
+// differs by the neighbors the cap left out. The cap is a quarter of the candidates the index finds for the average
+// tweet in full, so it binds at any scale, where [scheduler] candidate_cap is sized for a full window in production
+void replay(const Config &config, State &full, State &degraded, const vector<SyntheticTweet> &sources, bool lsh)
+{
+	vector<size_t> arrival_counts;
+	const size_t units = REPLAY_PERIODS + BURST_PERIODS * (BURST - 1);
+	for (auto period = 0u; period < REPLAY_PERIODS; ++period)
+	{
+		const bool burst = period >= BURST_START && period < BURST_START + BURST_PERIODS;
+		arrival_counts.push_back(sources.size() * (burst ? BURST : 1) / units);
+	}
+
+	// the seconds every period took updating and extracting, in full and degraded, in every replay
+	vector<vector<double>> updating[2], extracting[2];
+	for (auto i = 0u; i < 2; ++i)
+	{
+		updating[i].assign(REPLAY_PERIODS, {});
+		extracting[i].assign(REPLAY_PERIODS, {});
+	}
+	State* states[2] = {&full, &degraded};
+	unsigned int candidate_cap = 0;
+	uint64_t examined = 0, capped = 0;
+	for (auto repeat = 0u; repeat <= REPLAY_REPEATS; ++repeat)
+	{
+		// the first replay only runs in full, to size the cap and warm up
+		const unsigned int modes = repeat ? 2 : 1;
+		for (auto i = 0u; i < modes; ++i)
+			states[i]->reset(lsh ? LSH_INDEX : WORD_INDEX);
+
+		auto source = sources.begin();
+		for (auto period = 0u; period < REPLAY_PERIODS; ++period)
+		{
+			const unsigned int start = START + period * PERIOD;
+			vector<const SyntheticTweet*> arrivals;
+			for (auto i = 0u; i < arrival_counts[period]; ++i, ++source)
+				arrivals.push_back(&*source);
+
+			for (auto i = 0u; i < modes; ++i)
+			{
+				auto began = chrono::steady_clock::now();
+				states[i]->advance(arrivals, start, i ? candidate_cap : 0, false);
+				const auto updated = chrono::steady_clock::now();
+				states[i]->extract();
+				const auto extracted = chrono::steady_clock::now();
+				if (!repeat)
+					continue;
+				updating[i][period].push_back(chrono::duration<double>(updated - began).count());
+				extracting[i][period].push_back(chrono::duration<double>(extracted - updated).count());
+			}
+		}
+
+		if (!repeat)
+		{
+			const auto &counts = full.counts;
+			const size_t tweets = accumulate(arrival_counts.begin(), arrival_counts.end(), (size_t)0);
+			candidate_cap = max<size_t>(1, (counts.examined - min<uint64_t>(counts.examined, full.cores.size() * tweets)) / tweets / 4);
+		}
+		else
+		{
+			examined += degraded.counts.examined + degraded.counts.capped;
+			capped += degraded.counts.capped;
+		}
+	}
+
+	auto median = [](vector<double> values) {
+		nth_element(values.begin(), values.begin() + values.size() / 2, values.end());
+		return values[values.size() / 2];
+	};
+	vector<double> update_seconds[2], extract_seconds[2];
+	for (auto i = 0u; i < 2; ++i)
+	{
+		for (auto period = 0u; period < REPLAY_PERIODS; ++period)
+		{
+			update_seconds[i].push_back(median(updating[i][period]));
+			extract_seconds[i].push_back(median(extracting[i][period]));
+		}
+	}
+
+	// the window is full and the burst has not started
+	double steady = 0;
+	for (auto period = REPLAY_HISTORY; period < BURST_START; ++period)
+		steady += (update_seconds[0][period] + extract_seconds[0][period]) / (BURST_START - REPLAY_HISTORY);
+	const double scale = LOAD * PERIOD / steady;
+
+	vector<vector<PeriodScheduler::Plan>> plans(2);
+	for (const auto degrading : {false, true})
+	{
+		PeriodScheduler scheduler(PERIOD,
+			degrading ? config.degrade_lag : INFINITY, degrading ? config.recover_lag : INFINITY, config.max_skipped);
+		double now = 0;
+		for (auto period = 0u; period < REPLAY_PERIODS; ++period)
+		{
+			const unsigned int start = START + period * PERIOD;
+			now = max(now, start + PERIOD + 1.0);
+			const auto plan = scheduler.plan(start, now);
+			plans[degrading].push_back(plan);
+			now += scale * (update_seconds[plan.degraded][period] + (plan.extract ? extract_seconds[plan.degraded][period] : 0));
+		}
+	}
+
+	cout << "Replaying a " << BURST << "x burst" << (lsh ? " (lsh)" : " (words)") << ", one simulated second is "
+		<< setprecision(3) << 1 / scale << " s, degraded with a candidate cap of " << candidate_cap << " dropping "
+		<< 100.0 * capped / max<uint64_t>(1, examined) << "% of candidates" << endl;
+	cout << setw(8) << "period" << setw(10) << "tweets" << setw(14) << "lag s" << setw(14) << "degrading" << endl;
+	// periods after the burst starts until the lag is gone, 0 if it never built up, REPLAY_PERIODS if it outlasts the replay
+	int caught_up[2] = {0, 0};
+	for (auto i = 0u; i < 2; ++i)
+	{
+		bool behind = false;
+		for (auto period = 0u; period < REPLAY_PERIODS; ++period)
+		{
+			if (plans[i][period].lag > 0)
+			{
+				behind = true;
+				caught_up[i] = REPLAY_PERIODS;
+			}
+			else if (behind && caught_up[i] == (int)REPLAY_PERIODS)
+				caught_up[i] = (int)period - BURST_START;
+		}
+	}
+	for (auto period = 0u; period < REPLAY_PERIODS; ++period)
+	{
+		cout << setw(8) << period << setw(10) << arrival_counts[period] << fixed << setprecision(1)
+			<< setw(14) << plans[0][period].lag << setw(14) << plans[1][period].lag << defaultfloat
+			<< (plans[1][period].degraded ? "   degraded" : "") << (plans[1][period].extract ? "" : ", extraction skipped") << endl;
+	}
+	for (auto i = 0u; i < 2; ++i)
+	{
+		cout << (i ? "Degrading" : "Running in full");
+		if (!caught_up[i])
+			cout << " never falls behind" << endl;
+		else if (caught_up[i] == (int)REPLAY_PERIODS)
+			cout << " catches up after the replay ends" << endl;
+		else
+			cout << " catches up " << caught_up[i] << " periods after the burst starts" << endl;
+	}
+	cout << "degrading catches up no later than running in full: "
+		<< (caught_up[1] < (int)REPLAY_PERIODS && caught_up[1] <= caught_up[0] ? "yes" : "NO") << endl;
+}
+
+int main(int argc, char* argv[])
+{
+	const string path = argc > 1 ? argv[1] : "config.ini";
+	const size_t count = argc > 2 ? stoul(argv[2]) : 10000;
+
+	INIReader reader(path);
+	if (reader.ParseError() < 0)
+	{
+		cerr << "could not read " << path << endl;
+		return 1;
+	}
+	auto get = [&](const string &section, const string &option) {
+		const string value = reader.Get(section, option, "");
+		if (value.empty())
+		{
+			cerr << path << " has no " << option << " in [" << section << "]" << endl;
+			exit(1);
+		}
+		return value;
+	};
+
+	Config config;
+	config.west                 = stod(get("grid",         "west"));
+	config.east                 = stod(get("grid",         "east"));
+	config.south                = stod(get("grid",         "south"));
+	config.north                = stod(get("grid",         "north"));
+	config.cell_size            = stod(get("grid",         "cell_size"));
+	config.regional_radius      = stod(get("grid",         "regional_radius"));
+	config.circular             = get("grid", "region") == "circle";
+	config.vector_size          = stoi(get("tokens2vec",   "vector_size"));
+	config.epsilon              = stod(get("optics",       "epsilon"));
+	config.minimum_points       = stoi(get("optics",       "minimum_points"));
+	config.reachability_minimum = stod(get("optics",       "reachability_min"));
+	config.reachability_maximum = stod(get("optics",       "reachability_max"));
+	config.lsh_tables           = stoi(get("optics",       "lsh_tables"));
+	config.lsh_bits             = stoi(get("optics",       "lsh_bits"));
+	config.thread_count         = stoi(get("optimization", "thread_count"));
+	config.morton               = get("optimization", "window_layout") == "morton";
+	config.quantized            = get("optics",       "quantization") == "int8";
+	config.degrade_lag          = stod(get("scheduler",    "degrade_lag"));
+	config.recover_lag          = stod(get("scheduler",    "recover_lag"));
+	config.candidate_cap        = stoi(get("scheduler",    "candidate_cap"));
+	config.max_skipped          = stoi(get("scheduler",    "max_skipped"));
+
+	cout << "Generating " << count << " tweets" << endl;
+	Generator generator(config);
+	const auto sources = generator.generate(config, count);
+
+	ThreadPool pool(config.thread_count);
+	const char *kernel_name;
+	const auto dotProduct = TMDistance::selectDotProduct(config.vector_size, &kernel_name);
+	const char *quantized_kernel_name;
+	const auto quantizedDotProduct = TMDistance::selectQuantizedDotProduct(config.vector_size, &quantized_kernel_name);
+	Dictionary dictionary;
+
+	Tweet::delimiter = new Tweet();
+	Tweet::delimiter->smallest_reachability_distance = config.reachability_maximum + 1;
+	vector<Tweet*> cores;
+	for (const auto &topic : generator.topics)
+	{
+		cores.push_back(new Tweet(topic));
+		cores.back()->sequence = cores.size();
+		if (config.quantized)
+			cores.back()->quantize(config.vector_size);
+	}
+
+	cout << left << setw(32) << "benchmark" << right << setw(10) << "items" << setw(14) << "median ns" << setw(14) << "best ns"
+		<< setw(14) << "items/s" << "   checksum" << endl;
+
+	unique_ptr<CellGrid> grid;
+	run("CellGrid", 1, [&]() {
+		grid.reset(new CellGrid(config.west, config.east, config.south, config.north,
+			config.cell_size, config.regional_radius, config.circular));
+		return (double)grid->getRegionSize();
+	});
+
+	// distances between every pair of a sample, with every kernel this CPU has
+	vector<Tweet> sample;
+	for (auto i = 0u; i < min<size_t>(count, DISTANCE_SAMPLE); ++i)
+		sample.emplace_back(sources[i].feature_vector);
+	vector<pair<string, TMDistance::DotProduct>> kernels;
+	#define TM_SPECIALIZE(kernel) (config.vector_size == 128 ? kernel<128> : config.vector_size == 300 ? kernel<300> : kernel<0>)
+	kernels.emplace_back("scalar", TM_SPECIALIZE(TMDistance::dotScalar));
+#ifdef TM_DISTANCE_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("sse2"))
+		kernels.emplace_back("sse2", TM_SPECIALIZE(TMDistance::dotSSE2));
+	if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+		kernels.emplace_back("avx2", TM_SPECIALIZE(TMDistance::dotAVX2));
+	if (__builtin_cpu_supports("avx512f"))
+		kernels.emplace_back("avx512", TM_SPECIALIZE(TMDistance::dotAVX512));
+#endif
+	#undef TM_SPECIALIZE
+	for (const auto &kernel : kernels)
+	{
+		run(string("getDistance ") + kernel.first + (kernel.first == kernel_name ? " (selected)" : ""),
+			sample.size() * (sample.size() - 1) / 2, [&]() {
+				double sum = 0;
+				for (auto i = 0u; i < sample.size(); ++i)
+				{
+					for (auto j = 0u; j < i; ++j)
+						sum += getDistance(sample[i], sample[j], kernel.second, config.vector_size);
+				}
+				return sum;
+			});
+	}
+
+	// the same pairs screened through their int8 vectors first, counting those found within epsilon; the screen
+	// has to keep every pair the exact distance keeps
+	const auto withinEpsilon = [&](TMDistance::QuantizedDotProduct screen) {
+		double within = 0;
+		for (auto i = 0u; i < sample.size(); ++i)
+		{
+			for (auto j = 0u; j < i; ++j)
+			{
+				if (screen && !mayBeWithin(sample[i], sample[j], config.epsilon, screen, config.vector_size))
+					continue;
+				within += getDistance(sample[i], sample[j], dotProduct, config.vector_size) <= config.epsilon;
+			}
+		}
+		return within;
+	};
+	run("Tweet::quantize", sample.size(), [&]() {
+		double scale = 0;
+		for (auto &tweet : sample)
+		{
+			tweet.quantize(config.vector_size);
+			scale += tweet.quantized_scale;
+		}
+		return scale;
+	});
+	run("getDistance within epsilon", sample.size() * (sample.size() - 1) / 2, [&]() {
+		return withinEpsilon(nullptr);
+	});
+	run(string("getDistance ") + quantized_kernel_name + " screen", sample.size() * (sample.size() - 1) / 2, [&]() {
+		return withinEpsilon(quantizedDotProduct);
+	});
+	cout << "int8 screen keeps every pair within epsilon: " << (withinEpsilon(nullptr) == withinEpsilon(quantizedDotProduct) ? "yes" : "NO") << endl;
+
+	// the rest of the sample against the first of it as cluster cores: a pair at a time, screened, and a block at a time
+	vector<Tweet*> sample_cores, sample_rows;
+	for (auto i = 0u; i < sample.size(); ++i)
+	{
+		sample[i].sequence = i + 1;
+		(i < min<size_t>(CORE_SAMPLE, sample.size() / 2) ? sample_cores : sample_rows).push_back(&sample[i]);
+	}
+	// every distance is summed, and kept in distances if there is one
+	const auto coreDistances = [&](TMDistance::QuantizedDotProduct screen, vector<double>* distances) {
+		double sum = 0;
+		for (const auto &row : sample_rows)
+		{
+			for (const auto &core : sample_cores)
+			{
+				if (screen && !mayBeWithin(*core, *row, config.epsilon, screen, config.vector_size))
+					continue;
+				const double distance = getDistance(*core, *row, dotProduct, config.vector_size);
+				sum += distance;
+				if (distances)
+					distances->push_back(distance);
+			}
+		}
+		return sum;
+	};
+	// exact with a DotProductBlock, screened with a QuantizedDotProductBlock
+	const auto dotProductBlock = TMDistance::selectDotProductBlock(config.vector_size);
+	const auto quantizedDotProductBlock = TMDistance::selectQuantizedDotProductBlock(config.vector_size);
+	const auto blockDistances = [&](bool screen, vector<double>* distances) {
+		double sum = 0;
+		CoreDistances core_distances(sample_cores, dotProduct, screen ? nullptr : dotProductBlock,
+			screen ? quantizedDotProductBlock : nullptr, config.vector_size);
+		for (auto begin = 0u; begin < sample_rows.size(); begin += CORE_ROWS)
+		{
+			const auto end = min<size_t>(begin + CORE_ROWS, sample_rows.size());
+			core_distances.compute(&sample_rows[begin], end - begin);
+			for (auto i = begin; i < end; ++i)
+			{
+				for (const auto &core : sample_cores)
+				{
+					if (!core_distances.mayBeWithin(*core, i - begin, *sample_rows[i], config.epsilon))
+						continue;
+					const double distance = core_distances.getDistance(*core, i - begin, *sample_rows[i]);
+					sum += distance;
+					if (distances)
+						distances->push_back(distance);
+				}
+			}
+		}
+		return sum;
+	};
+	run(string("core distances ") + kernel_name, sample_rows.size() * sample_cores.size(), [&]() {
+		return coreDistances(nullptr, nullptr);
+	});
+	run(string("core distances ") + quantized_kernel_name + " screen", sample_rows.size() * sample_cores.size(), [&]() {
+		return coreDistances(quantizedDotProduct, nullptr);
+	});
+	run(string("core distances ") + kernel_name + " block", sample_rows.size() * sample_cores.size(), [&]() {
+		return blockDistances(false, nullptr);
+	});
+	run(string("core distances ") + quantized_kernel_name + " screen block", sample_rows.size() * sample_cores.size(), [&]() {
+		return blockDistances(true, nullptr);
+	});
+	vector<double> pair_distances, block_distances, screened_pair_distances, screened_block_distances;
+	coreDistances(nullptr, &pair_distances);
+	blockDistances(false, &block_distances);
+	coreDistances(quantizedDotProduct, &screened_pair_distances);
+	blockDistances(true, &screened_block_distances);
+	cout << "block distances match pair distances: " << (pair_distances == block_distances ? "yes" : "NO")
+		<< ", screened: " << (screened_pair_distances == screened_block_distances ? "yes" : "NO") << endl;
+
+	// every block kernel this CPU can run against the per-pair kernel of its instruction set, at every size up to past
+	// the widest lanes and at the sizes kernels are specialized for
+	{
+		#define TM_BLOCK_MATCHES(T, Dot, tile, kernel) [&](unsigned int size) { \
+			return blockMatches<T, Dot>(TMDistance::dotBlock<T, Dot, tile<0>>, kernel<0>, size, random) \
+				&& (size != 128 || blockMatches<T, Dot>(TMDistance::dotBlock<T, Dot, tile<128>>, kernel<128>, size, random)) \
+				&& (size != 300 || blockMatches<T, Dot>(TMDistance::dotBlock<T, Dot, tile<300>>, kernel<300>, size, random)); \
+			}
+		mt19937 random(SEED);
+		vector<pair<string, function<bool(unsigned int)>>> blocks;
+		blocks.emplace_back("scalar", TM_BLOCK_MATCHES(double, double, TMDistance::tileScalar, TMDistance::dotScalar));
+		blocks.emplace_back("int8 scalar", TM_BLOCK_MATCHES(int8_t, int32_t, TMDistance::tileInt8Scalar, TMDistance::dotInt8Scalar));
+#ifdef TM_DISTANCE_X86
+		if (__builtin_cpu_supports("sse2"))
+			blocks.emplace_back("sse2", TM_BLOCK_MATCHES(double, double, TMDistance::tileSSE2, TMDistance::dotSSE2));
+		if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+			blocks.emplace_back("avx2", TM_BLOCK_MATCHES(double, double, TMDistance::tileAVX2, TMDistance::dotAVX2));
+		if (__builtin_cpu_supports("avx512f"))
+			blocks.emplace_back("avx512", TM_BLOCK_MATCHES(double, double, TMDistance::tileAVX512, TMDistance::dotAVX512));
+		if (__builtin_cpu_supports("avx2"))
+			blocks.emplace_back("int8 avx2", TM_BLOCK_MATCHES(int8_t, int32_t, TMDistance::tileInt8AVX2, TMDistance::dotInt8AVX2));
+#endif
+		#undef TM_BLOCK_MATCHES
+		vector<unsigned int> sizes = {64, 127, 128, 129, 300, config.vector_size};
+		for (auto size = 1u; size <= 40; ++size)
+			sizes.push_back(size);
+		cout << "block kernels match pair kernels:";
+		for (const auto &block : blocks)
+		{
+			bool matches = true;
+			for (const auto &size : sizes)
+				matches = matches && block.second(size);
+			cout << " " << block.first << " " << (matches ? "yes" : "NO") << (&block == &blocks.back() ? "" : ",");
+		}
+		cout << endl;
+	}
+
+	vector<double> parsed(config.vector_size);
+	run("parseJSONVector", count, [&]() {
+		double sum = 0;
+		for (const auto &source : sources)
+		{
+			TMUtil::parseJSONVector(source.json_vector, parsed.data(), config.vector_size);
+			sum += parsed[0];
+		}
+		return sum;
+	});
+	{
+		// rows that used to be rejected by the json parser must still be; each would otherwise hold size values
+		string values;
+		for (auto i = 0u; i < config.vector_size; ++i)
+			values += (i ? "," : "") + to_string(i % 7 * 0.125);
+		const vector<string> malformed = {"", "[", "]", "[]", values, "[" + values, values + "]", "(" + values + ")",
+			"[" + values + ",]", "[" + values + ",1]", "[," + values + "]", "[" + values + ",,]", "[" + values + "]x"};
+		bool rejected = true;
+		for (const auto &row : malformed)
+		{
+			try
+			{
+				TMUtil::parseJSONVector(row, parsed.data(), config.vector_size);
+				rejected = false;
+				cout << "parseJSONVector accepted: " << row.substr(0, 40) << endl;
+			}
+			catch (const invalid_argument&) {}
+		}
+		TMUtil::parseJSONVector("[" + values + "]", parsed.data(), config.vector_size);
+		cout << "parseJSONVector rejects malformed rows: " << (rejected ? "yes" : "NO") << " (" << malformed.size() << " rows)" << endl;
+	}
+	run("parseBlobVector", count, [&]() {
+		double sum = 0;
+		for (const auto &source : sources)
+			sum += TMUtil::parseBlobVector(source.blob_vector, config.vector_size)[0];
+		return sum;
+	});
+
+	// tweets the way the index sees them, cleaned and placed on the grid
+	vector<unique_ptr<Tweet>> tweets;
+	for (auto i = 0u; i < count; ++i)
+	{
+		const auto &source = sources[i];
+		tweets.emplace_back(new Tweet(source.time, source.lat, source.lon, source.text, source.feature_vector));
+		tweets.back()->sequence = cores.size() + i + 1;
+	}
+	run("Tweet::clean", count, [&]() {
+		double words = 0;
+		for (auto &tweet : tweets)
+		{
+			tweet->words.clear();
+			tweet->clean(dictionary, config.cell_size);
+			words += tweet->words.size();
+		}
+		return words;
+	});
+	run("Tweet::clean regexes", count, [&]() {
+		double words = 0;
+		for (const auto &source : sources)
+			words += regexClean(source.text).size();
+		return words;
+	});
+	size_t tokenizer_mismatches = 0;
+	const auto tokenizer_cases = tokenizerCases(sources);
+	for (const auto &text : tokenizer_cases)
+	{
+		set<string> words;
+		TMTokenizer::tokenize(text, [&](const string &word) { words.insert(word); });
+		tokenizer_mismatches += words != regexClean(text);
+	}
+	cout << "tokenizer matches regexes: " << (tokenizer_mismatches ? "NO" : "yes")
+		<< " (" << tokenizer_cases.size() << " texts)" << endl;
+
+	for (const auto lsh : {false, true})
+	{
+		const string name = lsh ? "LshIndex::" : "WordIndex::";
+		unique_ptr<NeighborIndex> index(lsh
+			? (NeighborIndex*)new LshIndex(*grid, dotProduct, config.vector_size, config.lsh_tables, config.lsh_bits)
+			: (NeighborIndex*)new WordIndex(*grid));
+		bool filled = false;
+		auto fill = [&](bool full) {
+			if (filled == full)
+				return;
+			for (const auto &tweet : tweets)
+			{
+				if (full)
+					index->insert(tweet.get());
+				else
+					index->erase(tweet.get());
+			}
+			filled = full;
+		};
+
+		run(name + "insert", count, [&]() {
+			fill(true);
+			return (double)count;
+		}, [&]() { fill(false); });
+		run(name + "query", count, [&]() {
+			double candidates = 0;
+			vector<Tweet*> found;
+			for (const auto &tweet : tweets)
+			{
+				found.clear();
+				index->query(tweet.get(), found);
+				candidates += found.size();
+			}
+			return candidates;
+		}, [&]() { fill(true); });
+		run(name + "erase", count, [&]() {
+			fill(false);
+			return (double)count;
+		}, [&]() { fill(true); });
+		fill(false);
+	}
+	tweets.clear();
+
+	vector<vector<pair<unsigned long long, unsigned long long>>> neighbor_pairs(2);
+	for (const auto lsh : {false, true})
+	{
+		const string name = lsh ? " (lsh)" : " (words)";
+		const auto index_type = lsh ? LSH_INDEX : WORD_INDEX;
+		State state(config, dotProduct, config.quantized ? quantizedDotProduct : nullptr, pool, dictionary, cores, *grid);
+
+		run("updateTweets" + name, count, [&]() {
+			state.build(sources, index_type);
+			return (double)state.window->size();
+		});
+		neighbor_pairs[lsh] = state.getNeighborPairs();
+
+		// the shipped bounds take in everything within epsilon, so the plot is never cut and no cluster is ever closed;
+		// cut at the median reachability instead, which splits it into clusters around the topics
+		if (!lsh)
+		{
+			config.reachability_maximum = min(config.reachability_maximum, getMedianReachability(*state.window, config.epsilon));
+			cout << "reachability window: [" << config.reachability_minimum << ", " << config.reachability_maximum << "]" << endl;
+		}
+
+		// every distance computed from scratch, as after a restart
+		run("OpticsUpdater::update" + name, state.window->size(), [&]() {
+			state.optics_updater.update(pool, config.epsilon, config.minimum_points);
+			double reachable = 0;
+			for (const auto &slice : state.window->getSlices())
+			{
+				for (const auto &tweet : slice.second->tweets)
+					reachable += tweet->smallest_reachability_distance <= config.epsilon;
+			}
+			return reachable;
+		}, [&]() {
+			for (const auto &slice : state.window->getSlices())
+			{
+				for (const auto &tweet : slice.second->tweets)
+				{
+					tweet->core_distance = tweet->smallest_reachability_distance = INFINITY;
+					state.optics_updater.touch(tweet);
+				}
+			}
+		});
+
+		for (const auto parallel : {false, true})
+		{
+			run(string("getClusters") + (parallel ? " parallel" : "") + name, state.window->size(), [&]() {
+				const auto clusters = getClusters(*state.window, cores,
+					config.epsilon, config.reachability_minimum, config.reachability_maximum, MIN_TWEETS, parallel ? &pool : nullptr);
+				double clustered = 0;
+				for (const auto &cluster : clusters)
+					clustered += cluster.size();
+				return clusters.size() * 1e6 + clustered;
+			});
+		}
+
+		// the pool walks the same plot and cuts the same clusters as a single thread
+		const auto serial_clusters = getClusters(*state.window, cores,
+			config.epsilon, config.reachability_minimum, config.reachability_maximum, MIN_TWEETS);
+		const auto parallel_clusters = getClusters(*state.window, cores,
+			config.epsilon, config.reachability_minimum, config.reachability_maximum, MIN_TWEETS, &pool);
+		bool same = getSequences(getReachabilityPlot(*state.window, cores, config.epsilon, 0))
+			== getSequences(getReachabilityPlot(pool, *state.window, cores, config.epsilon, 0))
+			&& serial_clusters.size() == parallel_clusters.size();
+		for (auto i = 0u; same && i < serial_clusters.size(); ++i)
+			same = getSequences(serial_clusters[i]) == getSequences(parallel_clusters[i]);
+		cout << "getClusters parallel matches serial" << name << ": " << (same ? "yes" : "NO")
+			<< " (" << serial_clusters.size() << " clusters)" << endl;
+
+		// the oldest period ages out: everything expireTweets does
+		run("expireTweets" + name, state.window->getSlices().begin()->second->tweets.size(), [&]() {
+			const auto expired_tweets = state.window->expire(START + PERIOD - 1);
+			state.optics_updater.unlink(pool, expired_tweets);
+			for (const auto &tweet : expired_tweets)
+				state.index->erase(tweet);
+			state.window->releaseExpired();
+			return (double)state.window->size();
+		}, [&]() { state.build(sources, index_type); });
+	}
+
+	// a busy period ages out: the same expiry over a window whose oldest period had BURST times the usual tweets
+	{
+		State state(config, dotProduct, config.quantized ? quantizedDotProduct : nullptr, pool, dictionary, cores, *grid);
+		const size_t usual = count / (REPLAY_HISTORY - 1 + BURST);
+		auto fill = [&]() {
+			state.reset(WORD_INDEX);
+			auto source = sources.begin();
+			for (auto period = 0u; period < REPLAY_HISTORY; ++period)
+			{
+				vector<const SyntheticTweet*> arrivals;
+				for (auto i = 0u; i < (period ? usual : usual * BURST); ++i, ++source)
+					arrivals.push_back(&*source);
+				state.advance(arrivals, START + period * PERIOD, 0, false);
+			}
+		};
+		fill();
+		run("expireTweets burst (words)", state.window->getSlices().begin()->second->tweets.size(), [&]() {
+			const auto expired_tweets = state.window->expire(START + PERIOD - 1);
+			state.optics_updater.unlink(pool, expired_tweets);
+			for (const auto &tweet : expired_tweets)
+				state.index->erase(tweet);
+			state.window->releaseExpired();
+			return (double)state.window->size();
+		}, fill);
+	}
+
+	// both OPTICS passes over a window of LARGE_WINDOW tweets, on one thread and on the pool; the neighbor graph is
+	// made up directly, the passes only ever read neighbor lists
+	{
+		vector<Tweet> large(LARGE_WINDOW);
+		mt19937 random(SEED);
+		uniform_real_distribution<float> distance(0, config.epsilon);
+		for (auto i = 0u; i < large.size(); ++i)
+		{
+			for (auto k = 0u; k < LARGE_DEGREE / 2; ++k)
+			{
+				const auto j = i + 1 + random() % LARGE_SPREAD;
+				if (j >= large.size())
+					continue;
+				const float d = distance(random);
+				large[i].optics_neighbors.push_back(Neighbor{&large[j], d});
+				large[j].optics_neighbors.push_back(Neighbor{&large[i], d});
+			}
+		}
+		for (auto &tweet : large)
+			tweet.sortNeighbors();
+
+		OpticsUpdater optics_updater;
+		ThreadPool single(1);
+		for (auto threads : {&single, &pool})
+		{
+			const auto name = "OPTICS passes " + to_string(large.size() / 1000000) + "M (" + to_string(threads->size())
+				+ (threads->size() == 1 ? " thread)" : " threads)");
+			run(name, large.size(), [&]() {
+				optics_updater.update(*threads, config.epsilon, config.minimum_points);
+				double reachable = 0;
+				for (const auto &tweet : large)
+					reachable += tweet.smallest_reachability_distance <= config.epsilon;
+				return reachable;
+			}, [&]() {
+				for (auto &tweet : large)
+				{
+					tweet.core_distance = tweet.smallest_reachability_distance = INFINITY;
+					optics_updater.touch(&tweet);
+				}
+			});
+		}
+	}
+
+	// recall against every pair within epsilon in the same region, which the indexes only narrow down
+	{
+		State state(config, dotProduct, config.quantized ? quantizedDotProduct : nullptr, pool, dictionary, cores, *grid);
+		state.build(sources, REGION_INDEX);
+		const auto exact_pairs = state.getNeighborPairs();
+		for (const auto lsh : {false, true})
+		{
+			vector<pair<unsigned long long, unsigned long long>> found;
+			set_intersection(neighbor_pairs[lsh].begin(), neighbor_pairs[lsh].end(), exact_pairs.begin(), exact_pairs.end(),
+				back_inserter(found));
+			cout << (lsh ? "LshIndex" : "WordIndex") << " recall: " << found.size() << " of " << exact_pairs.size()
+				<< " neighbor pairs (" << setprecision(3) << (exact_pairs.empty() ? 1 : (double)found.size() / exact_pairs.size())
+				<< ")" << defaultfloat << endl;
+		}
+	}
+
+	// a snapshot restored into an empty window gives back the same reachability plot and clusters, and everything the
+	// event tables are written from; with a variant, so its events go through the snapshot too
+	{
+		Tweet::variant_count = 1;
+		for (auto &core : cores)
+			core->variants.resize(Tweet::variant_count);
+
+		State state(config, dotProduct, config.quantized ? quantizedDotProduct : nullptr, pool, dictionary, cores, *grid);
+		state.build(sources, WORD_INDEX);
+		for (const auto &slice : state.window->getSlices())
+		{
+			for (const auto &tweet : slice.second->tweets)
+			{
+				tweet->event = tweet->sequence % 7;
+				tweet->variants[0].event = tweet->sequence % 5;
+				tweet->exact = tweet->sequence % 2;
+			}
+		}
+
+		auto describe = [&]() {
+			auto plot = getReachabilityPlot(*state.window, cores, config.epsilon, 0);
+			ostringstream description;
+			description << setprecision(17);
+			for (const auto &tweet : plot)
+			{
+				if (tweet == Tweet::delimiter)
+				{
+					description << "-\n";
+					continue;
+				}
+				description << tweet->sequence << " " << tweet->core_distance << " " << tweet->smallest_reachability_distance
+					<< " " << tweet->event << " " << tweet->variants.at(0).event << " " << tweet->exact
+					<< " " << tweet->user << " " << tweet->text << "\n";
+			}
+			for (const auto &cluster : cutReachabilityPlot(plot, config.reachability_minimum, config.reachability_maximum, MIN_TWEETS, 0))
+			{
+				for (const auto &tweet : cluster)
+					description << tweet->sequence << " ";
+				description << "\n";
+			}
+			return description.str();
+		};
+		const auto before = describe();
+
+		const string path = "/tmp/pericog-bench-" + to_string(getpid()) + ".snapshot";
+		TMSnapshot::State snapshot_state{START + PERIODS * PERIOD, state.sequence, config.epsilon, config.epsilon,
+			config.minimum_points};
+		bool restored = TMSnapshot::save(path, *state.window, cores, config.vector_size, snapshot_state);
+		state.reset(WORD_INDEX);
+		vector<Tweet*> restored_tweets;
+		restored = restored && TMSnapshot::load(path, *state.window, cores, config.vector_size, snapshot_state, restored_tweets);
+		for (const auto &tweet : restored_tweets)
+		{
+			tweet->clean(dictionary, config.cell_size);
+			state.index->insert(tweet);
+		}
+
+		cout << "snapshot restores plot and clusters: " << (restored && describe() == before ? "yes" : "NO")
+			<< " (" << restored_tweets.size() << " tweets)" << endl;
+
+		// the distances kept only hold for the [optics] parameters they were derived with
+		bool rejected = true;
+		for (const auto &changed : {TMSnapshot::State{0, 0, config.epsilon, config.epsilon / 2, config.minimum_points},
+			TMSnapshot::State{0, 0, config.epsilon, config.epsilon, config.minimum_points + 1}})
+		{
+			auto load_state = changed;
+			Window window(PERIOD);
+			vector<Tweet*> loaded;
+			rejected = rejected && !TMSnapshot::load(path, window, cores, config.vector_size, load_state, loaded);
+		}
+		cout << "snapshot with other [optics] rejected: " << (rejected ? "yes" : "NO") << endl;
+
+		// neighbor lists reaching further than needed now are cut back to the current epsilon
+		vector<tuple<unsigned long long, unsigned long long, float>> expected, cut;
+		const double shorter = config.epsilon / 2;
+		size_t links = 0;
+		for (const auto &slice : state.window->getSlices())
+		{
+			for (const auto &tweet : slice.second->tweets)
+			{
+				links += tweet->optics_neighbors.size();
+				for (const auto &neighbor : tweet->optics_neighbors)
+				{
+					if (neighbor.distance <= (float)shorter)
+						expected.emplace_back(tweet->sequence, neighbor.tweet->sequence, neighbor.distance);
+				}
+			}
+		}
+		TMSnapshot::State shorter_state{0, 0, shorter, config.epsilon, config.minimum_points};
+		Window window(PERIOD);
+		vector<Tweet*> loaded;
+		const bool loaded_shorter = TMSnapshot::load(path, window, cores, config.vector_size, shorter_state, loaded);
+		for (const auto &tweet : loaded)
+		{
+			for (const auto &neighbor : tweet->optics_neighbors)
+				cut.emplace_back(tweet->sequence, neighbor.tweet->sequence, neighbor.distance);
+		}
+		sort(expected.begin(), expected.end());
+		sort(cut.begin(), cut.end());
+		cout << "snapshot neighbor lists cut to a shorter epsilon: " << (loaded_shorter && cut == expected ? "yes" : "NO")
+			<< " (" << expected.size() << " of " << links << " links)" << endl;
+		// the cores were restored into the throwaway window too
+		for (auto &core : cores)
+			core->optics_neighbors.clear();
+		unlink(path.c_str());
+
+		state.clear();
+		Tweet::variant_count = 0;
+		for (auto &core : cores)
+			core->variants.clear();
+	}
+
+	// the same window searched by 2x2 tiles in worker processes links the same neighbors at the same distances, so the
+	// clusters come out the same as in a single process
+	{
+		vector<tuple<unsigned long long, unsigned long long, float>> links[2];
+		vector<vector<unsigned long long>> clusters[2];
+		for (const auto sharded : {false, true})
+		{
+			unique_ptr<TMShards::Coordinator> coordinator;
+			if (sharded)
+			{
+				coordinator.reset(new TMShards::Coordinator(*grid, 2, 2, config.vector_size, [&](int socket, unsigned int) {
+					ThreadPool worker_pool(config.thread_count);
+					WordIndex index(*grid);
+					TMShards::Worker(socket, index, worker_pool, dotProduct, config.quantized ? quantizedDotProduct : nullptr,
+						config.quantized ? nullptr : TMDistance::selectDotProductBlock(config.vector_size),
+						config.quantized ? TMDistance::selectQuantizedDotProductBlock(config.vector_size) : nullptr,
+						config.vector_size, config.epsilon, PERIOD, config.morton).run();
+				}));
+				coordinator->setCores(cores);
+			}
+
+			State state(config, dotProduct, config.quantized ? quantizedDotProduct : nullptr, pool, dictionary, cores, *grid);
+			state.shards = coordinator.get();
+			state.build(sources, WORD_INDEX);
+
+			vector<Tweet*> tweets(cores);
+			for (const auto &slice : state.window->getSlices())
+				tweets.insert(tweets.end(), slice.second->tweets.begin(), slice.second->tweets.end());
+			for (const auto &tweet : tweets)
+			{
+				for (const auto &neighbor : tweet->optics_neighbors)
+					links[sharded].emplace_back(tweet->sequence, neighbor.tweet->sequence, neighbor.distance);
+			}
+			sort(links[sharded].begin(), links[sharded].end());
+
+			for (const auto &cluster : getClusters(*state.window, cores,
+				config.epsilon, config.reachability_minimum, config.reachability_maximum, MIN_TWEETS))
+			{
+				clusters[sharded].push_back(getSequences(cluster));
+			}
+			state.clear();
+		}
+		cout << "sharded 2x2 matches single process: " << (links[0] == links[1] && clusters[0] == clusters[1] ? "yes" : "NO")
+			<< " (" << links[0].size() / 2 << " neighbor pairs, " << clusters[0].size() << " clusters)" << endl;
+	}
+
+	// scoped, so the states let go of the cores before they are deleted; the two run side by side, so the degraded
+	// state links its tweets to cores of its own and indexes them in cells of its own
+	{
+		vector<unique_ptr<Tweet>> core_copies;
+		vector<Tweet*> degraded_cores;
+		for (const auto &core : cores)
+		{
+			core_copies.emplace_back(new Tweet(*core));
+			degraded_cores.push_back(core_copies.back().get());
+		}
+		CellGrid degraded_grid(config.west, config.east, config.south, config.north,
+			config.cell_size, config.regional_radius, config.circular);
+		State full(config, dotProduct, config.quantized ? quantizedDotProduct : nullptr, pool, dictionary, cores, *grid);
+		State degraded(config, dotProduct, config.quantized ? quantizedDotProduct : nullptr, pool, dictionary, degraded_cores,
+			degraded_grid);
+		replay(config, full, degraded, sources, false);
+	}
+
+	rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	cout << "Peak RSS: " << usage.ru_maxrss / 1024 << " MB" << endl;
+
+	for (auto &core : cores)
+		delete core;
+	delete Tweet::delimiter;
+	return 0;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <new>
+#include <memory>
+#include <vector>
+#include <utility>
+#include <cstddef>
+
+// bump allocator for objects that all die together; memory is only returned when the arena itself is destroyed,
+// and destructors are left to the owner
+class Arena
+{
+	static const size_t BLOCK_SIZE = 1 << 20;
+
+	std::vector<std::unique_ptr<char[]>> blocks;
+	size_t used = BLOCK_SIZE;
+
+public:
+	void* allocate(size_t size, size_t alignment);
+	template<class T, class... Args> T* create(Args&&... args);
+	size_t capacity() const;
+};
+
+void* Arena::allocate(size_t size, size_t alignment)
+{
+	used = (used + alignment - 1) / alignment * alignment;
+	if (used + size > BLOCK_SIZE)
+	{
+		// oversized requests get a block of their own
+		blocks.emplace_back(new char[size > BLOCK_SIZE ? size : BLOCK_SIZE]);
+		used = 0;
+	}
+
+	void* memory = blocks.back().get() + used;
+	used += size;
+	return memory;
+}
+
+template<class T, class... Args>
+T* Arena::create(Args&&... args)
+{
+	return new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+}
+
+size_t Arena::capacity() const
+{
+	return blocks.size() * BLOCK_SIZE;
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <deque>
+#include <vector>
+#include <algorithm>
+#include <mutex>
+#include <condition_variable>
+
+// a queue between one stage and the next that holds at most capacity items; producers block while it is full,
+// which pushes back on whatever is feeding them
+template<class T>
+class BoundedQueue
+{
+	std::mutex lock;
+	std::condition_variable not_full;
+	std::deque<T> items;
+	size_t capacity;
+	bool closed = false;
+
+public:
+	BoundedQueue(size_t capacity);
+
+	// returns false without queueing the item once the queue is closed
+	bool push(T &&item);
+	// moves up to limit queued items onto the end of out without waiting, and returns how many were moved
+	size_t popAll(std::vector<T> &out, size_t limit);
+	void close();
+	size_t size();
+	// how many more items can be pushed without blocking; none once the queue is closed
+	size_t available();
+};
+
+template<class T>
+BoundedQueue<T>::BoundedQueue(size_t capacity)
+	: capacity(capacity ? capacity : 1)
+{}
+
+template<class T>
+bool BoundedQueue<T>::push(T &&item)
+{
+	std::unique_lock<std::mutex> guard(lock);
+	not_full.wait(guard, [this]() { return closed || items.size() < capacity; });
+	if (closed)
+		return false;
+
+	items.push_back(std::move(item));
+	return true;
+}
+
+template<class T>
+size_t BoundedQueue<T>::popAll(std::vector<T> &out, size_t limit)
+{
+	size_t count;
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		count = std::min(limit, items.size());
+		for (auto i = 0u; i < count; ++i)
+		{
+			out.push_back(std::move(items.front()));
+			items.pop_front();
+		}
+	}
+
+	if (count)
+		not_full.notify_all();
+	return count;
+}
+
+template<class T>
+void BoundedQueue<T>::close()
+{
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		closed = true;
+	}
+	not_full.notify_all();
+}
+
+template<class T>
+size_t BoundedQueue<T>::size()
+{
+	std::lock_guard<std::mutex> guard(lock);
+	return items.size();
+}
+
+template<class T>
+size_t BoundedQueue<T>::available()
+{
+	std::lock_guard<std::mutex> guard(lock);
+	return closed ? 0 : capacity - items.size();
+}
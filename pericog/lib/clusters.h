@@ -0,0 +1,296 @@
+#pragma once
+
+#include <deque>
+#include <queue>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <utility>
+#include <unordered_set>
+
+#include "thread_pool.h"
+#include "window.h"
+#include "tweet.h"
+
+using namespace std;
+
+// appends the tree of tweets connected to the seed to the plot, in order of reachability; claim is asked once per
+// tweet reached and answers whether the tweet is still free to be taken into this tree
+//
+// everything here reads the distances of one parameter set, variant, and only the neighbors within its epsilon
+template<class Claim>
+void expandSeed(Tweet* seed, double epsilon, unsigned int variant, Claim claim, vector<Tweet*> &reachability_plot)
+{
+	const float within = epsilon;
+	// ties go by sequence rather than by address, so a restored window gives the same plot
+	struct Order
+	{
+		bool operator()(const pair<double, Tweet*> &a, const pair<double, Tweet*> &b) const
+		{
+			return a.first != b.first ? a.first < b.first : a.second->sequence < b.second->sequence;
+		}
+	};
+	priority_queue<pair<double, Tweet*>, deque<pair<double, Tweet*>>, Order> nodes;
+
+	nodes.push(make_pair(0, seed));
+	while (!nodes.empty())
+	{
+		// copied out before the pop, which destroys the queue's top
+		Tweet* tweet = nodes.top().second;
+		nodes.pop();
+		reachability_plot.push_back(tweet);
+
+		// acquire, but do not branch through border objects
+		if (tweet->coreDistance(variant) > epsilon)
+			continue;
+
+		for (const auto &neighbor : tweet->optics_neighbors)
+		{
+			if (neighbor.distance > within)
+				break;
+			const auto &optics_neighbor = neighbor.tweet;
+			if (!claim(optics_neighbor))
+				continue;
+			nodes.push(make_pair(optics_neighbor->smallestReachabilityDistance(variant), optics_neighbor));
+		}
+	}
+}
+
+// walks the reachability plot out from every seed in turn; each tweet goes to the first seed that reaches it
+vector<Tweet*> getReachabilityPlot(const Window &tweets, const vector<Tweet*> &seeds, double epsilon, unsigned int variant)
+{
+	// construct a container of all non-noise tweets for processing
+	unordered_set<Tweet*> tweets_to_process;
+	for (const auto &slice : tweets.getSlices())
+	{
+		for (const auto &tweet : slice.second->tweets)
+		{
+			if (tweet->smallestReachabilityDistance(variant) > epsilon)
+				continue;
+
+			tweets_to_process.insert(tweet);
+		}
+	}
+
+	vector<Tweet*> reachability_plot;
+	reachability_plot.reserve(tweets_to_process.size() + seeds.size() * 2);
+	for (const auto &seed : seeds)
+	{
+		reachability_plot.push_back(Tweet::delimiter);
+		expandSeed(seed, epsilon, variant, [&](Tweet* tweet) { return tweets_to_process.erase(tweet) > 0; }, reachability_plot);
+	}
+	return reachability_plot;
+}
+
+// the same plot, with the seeds expanded concurrently; a seed can only take tweets no earlier seed reaches, and those
+// follow from which cores are connected to which, so the connected components of the cores are found first with a
+// concurrent union-find, every tweet is given to its seed, and then each seed's tree is walked on its own
+vector<Tweet*> getReachabilityPlot(ThreadPool &pool, const Window &tweets, const vector<Tweet*> &seeds, double epsilon,
+	unsigned int variant)
+{
+	const uint32_t NONE = UINT32_MAX;
+	const float within = epsilon;
+
+	// every tweet a neighbor list can point at is indexed afresh, noise and seeds with NONE
+	vector<Tweet*> nodes;
+	for (const auto &slice : tweets.getSlices())
+	{
+		for (const auto &tweet : slice.second->tweets)
+		{
+			tweet->plot_index = NONE;
+			if (tweet->smallestReachabilityDistance(variant) > epsilon)
+				continue;
+			tweet->plot_index = nodes.size();
+			nodes.push_back(tweet);
+		}
+	}
+	for (const auto &seed : seeds)
+		seed->plot_index = NONE;
+	auto getIndex = [](const Tweet* tweet) {
+		return tweet->plot_index;
+	};
+	auto isCore = [&](const Tweet* tweet) {
+		return tweet->coreDistance(variant) <= epsilon;
+	};
+
+	// parents only ever point at smaller indices, so every component ends up rooted at its smallest index
+	// whichever order the links are made in
+	unique_ptr<atomic<uint32_t>[]> parents(new atomic<uint32_t>[nodes.size()]), owners(new atomic<uint32_t>[nodes.size()]);
+	pool.parallelFor(nodes.size(), 1024, [&](size_t begin, size_t end, unsigned int) {
+		for (auto i = begin; i < end; ++i)
+		{
+			parents[i].store(i, memory_order_relaxed);
+			owners[i].store(NONE, memory_order_relaxed);
+		}
+	});
+	auto find = [&](uint32_t i) {
+		for (auto parent = parents[i].load(); parent != i; parent = parents[i].load())
+		{
+			// halve the path on the way up, a stale grandparent is still an ancestor
+			const auto grandparent = parents[parent].load();
+			parents[i].compare_exchange_weak(parent, grandparent);
+			i = parent;
+		}
+		return i;
+	};
+	auto unite = [&](uint32_t a, uint32_t b) {
+		while (true)
+		{
+			a = find(a);
+			b = find(b);
+			if (a == b)
+				return;
+			if (a < b)
+				swap(a, b);
+			uint32_t root = a;
+			if (parents[a].compare_exchange_strong(root, b))
+				return;
+		}
+	};
+	auto takeSmaller = [](atomic<uint32_t> &owner, uint32_t seed) {
+		auto current = owner.load(memory_order_relaxed);
+		while (seed < current && !owner.compare_exchange_weak(current, seed, memory_order_relaxed));
+	};
+
+	// cores are joined through the cores among their neighbors
+	pool.parallelFor(nodes.size(), 256, [&](size_t begin, size_t end, unsigned int) {
+		for (auto i = begin; i < end; ++i)
+		{
+			if (!isCore(nodes[i]))
+				continue;
+			for (const auto &neighbor : nodes[i]->optics_neighbors)
+			{
+				if (neighbor.distance > within)
+					break;
+				const auto j = getIndex(neighbor.tweet);
+				if (j != NONE && j < i && isCore(neighbor.tweet))
+					unite(i, j);
+			}
+		}
+	});
+
+	// a component belongs to the first seed next to any of its cores, and so does a border tweet next to a seed;
+	// owners of components are kept at their roots
+	pool.parallelFor(seeds.size(), 1, [&](size_t begin, size_t end, unsigned int) {
+		for (auto k = begin; k < end; ++k)
+		{
+			if (!isCore(seeds[k]))
+				continue;
+			for (const auto &neighbor : seeds[k]->optics_neighbors)
+			{
+				if (neighbor.distance > within)
+					break;
+				const auto j = getIndex(neighbor.tweet);
+				if (j != NONE)
+					takeSmaller(owners[isCore(neighbor.tweet) ? find(j) : j], k);
+			}
+		}
+	});
+
+	// every other border tweet belongs to the first seed owning a component next to it, and cores to their component's
+	pool.parallelFor(nodes.size(), 256, [&](size_t begin, size_t end, unsigned int) {
+		for (auto i = begin; i < end; ++i)
+		{
+			if (isCore(nodes[i]))
+				continue;
+			for (const auto &neighbor : nodes[i]->optics_neighbors)
+			{
+				if (neighbor.distance > within)
+					break;
+				const auto j = getIndex(neighbor.tweet);
+				if (j != NONE && isCore(neighbor.tweet))
+					takeSmaller(owners[i], owners[find(j)].load(memory_order_relaxed));
+			}
+		}
+	});
+	pool.parallelFor(nodes.size(), 1024, [&](size_t begin, size_t end, unsigned int) {
+		for (auto i = begin; i < end; ++i)
+		{
+			if (isCore(nodes[i]))
+				owners[i].store(owners[find(i)].load(memory_order_relaxed), memory_order_relaxed);
+		}
+	});
+
+	// each tweet is only ever claimed by the walk of the seed owning it, so the walks need no locking
+	vector<char> claimed(nodes.size(), false);
+	vector<vector<Tweet*>> plots(seeds.size());
+	pool.parallelFor(seeds.size(), 1, [&](size_t begin, size_t end, unsigned int) {
+		for (auto k = begin; k < end; ++k)
+		{
+			plots[k].push_back(Tweet::delimiter);
+			expandSeed(seeds[k], epsilon, variant, [&](Tweet* tweet) {
+				const auto j = getIndex(tweet);
+				if (j == NONE || claimed[j] || owners[j].load(memory_order_relaxed) != k)
+					return false;
+				claimed[j] = true;
+				return true;
+			}, plots[k]);
+		}
+	});
+
+	vector<Tweet*> reachability_plot;
+	reachability_plot.reserve(nodes.size() + seeds.size() * 2);
+	for (const auto &plot : plots)
+		reachability_plot.insert(reachability_plot.end(), plot.begin(), plot.end());
+	return reachability_plot;
+}
+
+// cuts the reachability plot into clusters wherever the smallest reachability distance leaves
+// [reachability_minimum, reachability_maximum]; clusters need more than minimum_tweets tweets and more than one user
+vector<vector<Tweet*>> cutReachabilityPlot(vector<Tweet*> &reachability_plot,
+	double reachability_minimum, double reachability_maximum, unsigned int minimum_tweets, unsigned int variant)
+{
+	vector<vector<Tweet*>> clusters;
+	bool in_cluster = false;
+	vector<Tweet*>::iterator cluster_start;
+	for (auto i = reachability_plot.begin(); i != reachability_plot.end(); i++)
+	{
+		if (!(*i)->time)
+			continue;
+
+		const double smallest_reachability_distance = (*i)->smallestReachabilityDistance(variant);
+		if (!in_cluster
+		&& smallest_reachability_distance <= reachability_maximum
+		&& smallest_reachability_distance >= reachability_minimum)
+		{
+			cluster_start = i;
+			in_cluster = true;
+		}
+		else if (in_cluster
+		&& (smallest_reachability_distance > reachability_maximum ||
+			smallest_reachability_distance < reachability_minimum))
+		{
+			vector<Tweet*> cluster(cluster_start, i);
+			in_cluster = false;
+			if (cluster.size() > minimum_tweets)
+			{
+				const string &first_user = cluster[0]->user;
+				for (const auto &tweet : cluster)
+				{
+					if (tweet->time
+					&& tweet->user != first_user)
+					{
+						clusters.push_back(cluster);
+						break;
+					}
+				}
+			}
+		}
+	}
+
+	return clusters;
+}
+
+// walks the reachability plot out from every seed and cuts it into clusters; with a pool, the seeds are expanded
+// concurrently into the same plot a single thread would walk
+vector<vector<Tweet*>> getClusters(const Window &tweets, const vector<Tweet*> &seeds,
+	double epsilon, double reachability_minimum, double reachability_maximum, unsigned int minimum_tweets,
+	ThreadPool* pool = nullptr, unsigned int variant = 0)
+{
+	auto reachability_plot = pool
+		? getReachabilityPlot(*pool, tweets, seeds, epsilon, variant)
+		: getReachabilityPlot(tweets, seeds, epsilon, variant);
+	return cutReachabilityPlot(reachability_plot, reachability_minimum, reachability_maximum, minimum_tweets, variant);
+}
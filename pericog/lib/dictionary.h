@@ -0,0 +1,52 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <unordered_map>
+#include <shared_mutex>
+#include <mutex>
+
+using namespace std;
+
+// gives every word a 32-bit id, so tweets and the index hash and compare integers instead of strings;
+// almost every lookup finds a known word, so lookups share the lock and only new words take it exclusively
+class Dictionary
+{
+	mutable shared_timed_mutex lock;
+	unordered_map<string, uint32_t> ids;
+	vector<string> words;
+
+public:
+	uint32_t intern(const string &word);
+	const string &getWord(uint32_t id) const;
+	size_t size() const;
+};
+
+uint32_t Dictionary::intern(const string &word)
+{
+	{
+		shared_lock<shared_timed_mutex> read_lock(lock);
+		auto found = ids.find(word);
+		if (found != ids.end())
+			return found->second;
+	}
+
+	unique_lock<shared_timed_mutex> write_lock(lock);
+	auto inserted = ids.emplace(word, words.size());
+	if (inserted.second)
+		words.push_back(word);
+	return inserted.first->second;
+}
+
+const string &Dictionary::getWord(uint32_t id) const
+{
+	shared_lock<shared_timed_mutex> read_lock(lock);
+	return words.at(id);
+}
+
+size_t Dictionary::size() const
+{
+	shared_lock<shared_timed_mutex> read_lock(lock);
+	return words.size();
+}
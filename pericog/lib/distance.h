@@ -0,0 +1,546 @@
+#pragma once
+
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define TM_DISTANCE_X86
+#endif
+
+namespace TMDistance
+{
+	typedef double (*DotProduct)(const double *a, const double *b, unsigned int size);
+	typedef int32_t (*QuantizedDotProduct)(const int8_t *a, const int8_t *b, unsigned int size);
+
+	// every kernel is a template on the vector size: SIZE = 0 reads the size at runtime,
+	// anything else lets the compiler fully unroll for the configured vector_size
+	template<unsigned int SIZE>
+	double dotScalar(const double *a, const double *b, unsigned int size)
+	{
+		if (SIZE)
+			size = SIZE;
+
+		double dot = 0.0;
+		for (auto i = 0u; i < size; ++i)
+			dot += a[i] * b[i];
+		return dot;
+	}
+
+#ifdef TM_DISTANCE_X86
+	template<unsigned int SIZE>
+	__attribute__((target("sse2")))
+	double dotSSE2(const double *a, const double *b, unsigned int size)
+	{
+		if (SIZE)
+			size = SIZE;
+
+		__m128d sum0 = _mm_setzero_pd(), sum1 = _mm_setzero_pd();
+		auto i = 0u;
+		for (; i + 4 <= size; i += 4)
+		{
+			sum0 = _mm_add_pd(sum0, _mm_mul_pd(_mm_loadu_pd(a + i),     _mm_loadu_pd(b + i)));
+			sum1 = _mm_add_pd(sum1, _mm_mul_pd(_mm_loadu_pd(a + i + 2), _mm_loadu_pd(b + i + 2)));
+		}
+		sum0 = _mm_add_pd(sum0, sum1);
+
+		double lanes[2];
+		_mm_storeu_pd(lanes, sum0);
+		double dot = lanes[0] + lanes[1];
+		for (; i < size; ++i)
+			dot += a[i] * b[i];
+		return dot;
+	}
+
+	template<unsigned int SIZE>
+	__attribute__((target("avx2,fma")))
+	double dotAVX2(const double *a, const double *b, unsigned int size)
+	{
+		if (SIZE)
+			size = SIZE;
+
+		// four independent accumulators hide the latency of the fused multiply-adds
+		__m256d sum0 = _mm256_setzero_pd(), sum1 = _mm256_setzero_pd(), sum2 = _mm256_setzero_pd(), sum3 = _mm256_setzero_pd();
+		auto i = 0u;
+		for (; i + 16 <= size; i += 16)
+		{
+			sum0 = _mm256_fmadd_pd(_mm256_loadu_pd(a + i),      _mm256_loadu_pd(b + i),      sum0);
+			sum1 = _mm256_fmadd_pd(_mm256_loadu_pd(a + i + 4),  _mm256_loadu_pd(b + i + 4),  sum1);
+			sum2 = _mm256_fmadd_pd(_mm256_loadu_pd(a + i + 8),  _mm256_loadu_pd(b + i + 8),  sum2);
+			sum3 = _mm256_fmadd_pd(_mm256_loadu_pd(a + i + 12), _mm256_loadu_pd(b + i + 12), sum3);
+		}
+		for (; i + 4 <= size; i += 4)
+			sum0 = _mm256_fmadd_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i), sum0);
+		sum0 = _mm256_add_pd(_mm256_add_pd(sum0, sum1), _mm256_add_pd(sum2, sum3));
+
+		__m128d half = _mm_add_pd(_mm256_castpd256_pd128(sum0), _mm256_extractf128_pd(sum0, 1));
+		double lanes[2];
+		_mm_storeu_pd(lanes, half);
+		double dot = lanes[0] + lanes[1];
+		for (; i < size; ++i)
+			dot += a[i] * b[i];
+		return dot;
+	}
+
+	template<unsigned int SIZE>
+	__attribute__((target("avx512f")))
+	double dotAVX512(const double *a, const double *b, unsigned int size)
+	{
+		if (SIZE)
+			size = SIZE;
+
+		__m512d sum0 = _mm512_setzero_pd(), sum1 = _mm512_setzero_pd();
+		auto i = 0u;
+		for (; i + 16 <= size; i += 16)
+		{
+			sum0 = _mm512_fmadd_pd(_mm512_loadu_pd(a + i),     _mm512_loadu_pd(b + i),     sum0);
+			sum1 = _mm512_fmadd_pd(_mm512_loadu_pd(a + i + 8), _mm512_loadu_pd(b + i + 8), sum1);
+		}
+		if (i < size)
+		{
+			// masked loads take care of the tail without a scalar loop
+			const __mmask8 mask = (1u << (size - i < 8 ? size - i : 8)) - 1;
+			sum0 = _mm512_fmadd_pd(_mm512_maskz_loadu_pd(mask, a + i), _mm512_maskz_loadu_pd(mask, b + i), sum0);
+			i += 8;
+			if (i < size)
+			{
+				const __mmask8 mask = (1u << (size - i)) - 1;
+				sum1 = _mm512_fmadd_pd(_mm512_maskz_loadu_pd(mask, a + i), _mm512_maskz_loadu_pd(mask, b + i), sum1);
+			}
+		}
+		double lanes[8];
+		_mm512_storeu_pd(lanes, _mm512_add_pd(sum0, sum1));
+		return ((lanes[0] + lanes[1]) + (lanes[2] + lanes[3])) + ((lanes[4] + lanes[5]) + (lanes[6] + lanes[7]));
+	}
+#endif
+
+	// int8 kernels sum their products as integers, so every kernel gives exactly the same result
+	template<unsigned int SIZE>
+	int32_t dotInt8Scalar(const int8_t *a, const int8_t *b, unsigned int size)
+	{
+		if (SIZE)
+			size = SIZE;
+
+		int32_t dot = 0;
+		for (auto i = 0u; i < size; ++i)
+			dot += a[i] * b[i];
+		return dot;
+	}
+
+#ifdef TM_DISTANCE_X86
+	template<unsigned int SIZE>
+	__attribute__((target("avx2")))
+	int32_t dotInt8AVX2(const int8_t *a, const int8_t *b, unsigned int size)
+	{
+		if (SIZE)
+			size = SIZE;
+
+		// widened to 16 bits, then each pair of products is added into a 32-bit lane
+		__m256i sum0 = _mm256_setzero_si256(), sum1 = _mm256_setzero_si256();
+		auto i = 0u;
+		for (; i + 32 <= size; i += 32)
+		{
+			sum0 = _mm256_add_epi32(sum0, _mm256_madd_epi16(
+				_mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i*)(a + i))),
+				_mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i*)(b + i)))));
+			sum1 = _mm256_add_epi32(sum1, _mm256_madd_epi16(
+				_mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i*)(a + i + 16))),
+				_mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i*)(b + i + 16)))));
+		}
+		sum0 = _mm256_add_epi32(sum0, sum1);
+
+		int32_t lanes[8];
+		_mm256_storeu_si256((__m256i*)lanes, sum0);
+		int32_t dot = ((lanes[0] + lanes[1]) + (lanes[2] + lanes[3])) + ((lanes[4] + lanes[5]) + (lanes[6] + lanes[7]));
+		for (; i < size; ++i)
+			dot += a[i] * b[i];
+		return dot;
+	}
+#endif
+
+	// the dot products of every vector of a with every vector of b, into dots[i * b_count + j]; each one comes out
+	// exactly as the DotProduct kernel of the same instruction set would compute it on its own
+	typedef void (*DotProductBlock)(const double* const *a, unsigned int a_count, const double* const *b, unsigned int b_count,
+		unsigned int size, double *dots);
+	// the same for int8 vectors, which come out as any QuantizedDotProduct kernel would compute them
+	typedef void (*QuantizedDotProductBlock)(const int8_t* const *a, unsigned int a_count, const int8_t* const *b,
+		unsigned int b_count, unsigned int size, int32_t *dots);
+
+	// tiles are TILE_ROWS vectors of a by TILE_COLUMNS of b, so each vector loaded is used for several products
+	const unsigned int TILE_ROWS = 2, TILE_COLUMNS = 4, BLOCK_BYTES = 24 * 1024;
+
+	template<class T, class Dot, void (*tile)(const T* const *a, const T* const *b, unsigned int size, Dot *dots)>
+	void dotBlock(const T* const *a, unsigned int a_count, const T* const *b, unsigned int b_count, unsigned int size, Dot *dots)
+	{
+		// a block of b small enough to stay in the L1 cache while every tile of a runs past it
+		const unsigned int block_columns = std::max(1u, BLOCK_BYTES / (unsigned int)(sizeof(T) * std::max(size, 1u)) / TILE_COLUMNS) * TILE_COLUMNS;
+		const T *rows[TILE_ROWS], *columns[TILE_COLUMNS];
+		Dot tile_dots[TILE_ROWS * TILE_COLUMNS];
+		for (auto block = 0u; block < b_count; block += block_columns)
+		{
+			const auto block_end = std::min(block + block_columns, b_count);
+			for (auto i = 0u; i < a_count; i += TILE_ROWS)
+			{
+				// tiles hanging over the edge repeat the last vector and drop what they compute for it
+				for (auto r = 0u; r < TILE_ROWS; ++r)
+					rows[r] = a[std::min(i + r, a_count - 1)];
+				for (auto j = block; j < block_end; j += TILE_COLUMNS)
+				{
+					for (auto c = 0u; c < TILE_COLUMNS; ++c)
+						columns[c] = b[std::min(j + c, block_end - 1)];
+					tile(rows, columns, size, tile_dots);
+
+					for (auto r = 0u; r < TILE_ROWS && i + r < a_count; ++r)
+					{
+						for (auto c = 0u; c < TILE_COLUMNS && j + c < block_end; ++c)
+							dots[(i + r) * b_count + j + c] = tile_dots[r * TILE_COLUMNS + c];
+					}
+				}
+			}
+		}
+	}
+
+	template<unsigned int SIZE>
+	void tileScalar(const double* const *a, const double* const *b, unsigned int size, double *dots)
+	{
+		if (SIZE)
+			size = SIZE;
+
+		double sums[TILE_ROWS][TILE_COLUMNS] = {};
+		for (auto i = 0u; i < size; ++i)
+		{
+			for (auto r = 0u; r < TILE_ROWS; ++r)
+			{
+				for (auto c = 0u; c < TILE_COLUMNS; ++c)
+					sums[r][c] += a[r][i] * b[c][i];
+			}
+		}
+		for (auto r = 0u; r < TILE_ROWS; ++r)
+		{
+			for (auto c = 0u; c < TILE_COLUMNS; ++c)
+				dots[r * TILE_COLUMNS + c] = sums[r][c];
+		}
+	}
+
+#ifdef TM_DISTANCE_X86
+	// the SIMD tiles keep the accumulators of their kernel apart, each summing its own lanes of the vectors, so they
+	// sum one accumulator of every pair at a time and then combine them in the kernel's order
+	template<unsigned int SIZE>
+	__attribute__((target("sse2")))
+	void tileSSE2(const double* const *a, const double* const *b, unsigned int size, double *dots)
+	{
+		if (SIZE)
+			size = SIZE;
+
+		const auto end = size / 4 * 4;
+		__m128d sums[2][TILE_ROWS][TILE_COLUMNS];
+		for (auto k = 0u; k < 2; ++k)
+		{
+			__m128d sum[TILE_ROWS][TILE_COLUMNS];
+			for (auto r = 0u; r < TILE_ROWS; ++r)
+			{
+				for (auto c = 0u; c < TILE_COLUMNS; ++c)
+					sum[r][c] = _mm_setzero_pd();
+			}
+			for (auto i = k * 2; i < end; i += 4)
+			{
+				__m128d row[TILE_ROWS];
+				for (auto r = 0u; r < TILE_ROWS; ++r)
+					row[r] = _mm_loadu_pd(a[r] + i);
+				for (auto c = 0u; c < TILE_COLUMNS; ++c)
+				{
+					const __m128d column = _mm_loadu_pd(b[c] + i);
+					for (auto r = 0u; r < TILE_ROWS; ++r)
+						sum[r][c] = _mm_add_pd(sum[r][c], _mm_mul_pd(row[r], column));
+				}
+			}
+			for (auto r = 0u; r < TILE_ROWS; ++r)
+			{
+				for (auto c = 0u; c < TILE_COLUMNS; ++c)
+					sums[k][r][c] = sum[r][c];
+			}
+		}
+
+		for (auto r = 0u; r < TILE_ROWS; ++r)
+		{
+			for (auto c = 0u; c < TILE_COLUMNS; ++c)
+			{
+				double lanes[2];
+				_mm_storeu_pd(lanes, _mm_add_pd(sums[0][r][c], sums[1][r][c]));
+				double dot = lanes[0] + lanes[1];
+				for (auto i = end; i < size; ++i)
+					dot += a[r][i] * b[c][i];
+				dots[r * TILE_COLUMNS + c] = dot;
+			}
+		}
+	}
+
+	template<unsigned int SIZE>
+	__attribute__((target("avx2,fma")))
+	void tileAVX2(const double* const *a, const double* const *b, unsigned int size, double *dots)
+	{
+		if (SIZE)
+			size = SIZE;
+
+		// the kernel's first accumulator also takes the whole chunks of four past the last chunk of sixteen
+		const auto end = size / 16 * 16, tail_end = size / 4 * 4;
+		__m256d sums[4][TILE_ROWS][TILE_COLUMNS];
+		for (auto k = 0u; k < 4; ++k)
+		{
+			__m256d sum[TILE_ROWS][TILE_COLUMNS];
+			for (auto r = 0u; r < TILE_ROWS; ++r)
+			{
+				for (auto c = 0u; c < TILE_COLUMNS; ++c)
+					sum[r][c] = _mm256_setzero_pd();
+			}
+			for (auto i = k * 4; i < (k ? end : tail_end); i += i < end ? 16 : 4)
+			{
+				__m256d row[TILE_ROWS];
+				for (auto r = 0u; r < TILE_ROWS; ++r)
+					row[r] = _mm256_loadu_pd(a[r] + i);
+				for (auto c = 0u; c < TILE_COLUMNS; ++c)
+				{
+					const __m256d column = _mm256_loadu_pd(b[c] + i);
+					for (auto r = 0u; r < TILE_ROWS; ++r)
+						sum[r][c] = _mm256_fmadd_pd(row[r], column, sum[r][c]);
+				}
+			}
+			for (auto r = 0u; r < TILE_ROWS; ++r)
+			{
+				for (auto c = 0u; c < TILE_COLUMNS; ++c)
+					sums[k][r][c] = sum[r][c];
+			}
+		}
+
+		for (auto r = 0u; r < TILE_ROWS; ++r)
+		{
+			for (auto c = 0u; c < TILE_COLUMNS; ++c)
+			{
+				const __m256d sum = _mm256_add_pd(_mm256_add_pd(sums[0][r][c], sums[1][r][c]), _mm256_add_pd(sums[2][r][c], sums[3][r][c]));
+				const __m128d half = _mm_add_pd(_mm256_castpd256_pd128(sum), _mm256_extractf128_pd(sum, 1));
+				double lanes[2];
+				_mm_storeu_pd(lanes, half);
+				double dot = lanes[0] + lanes[1];
+				for (auto i = tail_end; i < size; ++i)
+					dot += a[r][i] * b[c][i];
+				dots[r * TILE_COLUMNS + c] = dot;
+			}
+		}
+	}
+
+	template<unsigned int SIZE>
+	__attribute__((target("avx512f")))
+	void tileAVX512(const double* const *a, const double* const *b, unsigned int size, double *dots)
+	{
+		if (SIZE)
+			size = SIZE;
+
+		// past the last chunk of sixteen, each accumulator takes one masked chunk of eight, if there is any left of it
+		const auto end = size / 16 * 16;
+		__m512d sums[2][TILE_ROWS][TILE_COLUMNS];
+		for (auto k = 0u; k < 2; ++k)
+		{
+			__m512d sum[TILE_ROWS][TILE_COLUMNS];
+			for (auto r = 0u; r < TILE_ROWS; ++r)
+			{
+				for (auto c = 0u; c < TILE_COLUMNS; ++c)
+					sum[r][c] = _mm512_setzero_pd();
+			}
+			for (auto i = k * 8; i < end; i += 16)
+			{
+				__m512d row[TILE_ROWS];
+				for (auto r = 0u; r < TILE_ROWS; ++r)
+					row[r] = _mm512_loadu_pd(a[r] + i);
+				for (auto c = 0u; c < TILE_COLUMNS; ++c)
+				{
+					const __m512d column = _mm512_loadu_pd(b[c] + i);
+					for (auto r = 0u; r < TILE_ROWS; ++r)
+						sum[r][c] = _mm512_fmadd_pd(row[r], column, sum[r][c]);
+				}
+			}
+			const auto i = end + k * 8;
+			if (i < size)
+			{
+				const __mmask8 mask = (1u << (size - i < 8 ? size - i : 8)) - 1;
+				for (auto c = 0u; c < TILE_COLUMNS; ++c)
+				{
+					const __m512d column = _mm512_maskz_loadu_pd(mask, b[c] + i);
+					for (auto r = 0u; r < TILE_ROWS; ++r)
+						sum[r][c] = _mm512_fmadd_pd(_mm512_maskz_loadu_pd(mask, a[r] + i), column, sum[r][c]);
+				}
+			}
+			for (auto r = 0u; r < TILE_ROWS; ++r)
+			{
+				for (auto c = 0u; c < TILE_COLUMNS; ++c)
+					sums[k][r][c] = sum[r][c];
+			}
+		}
+
+		for (auto r = 0u; r < TILE_ROWS; ++r)
+		{
+			for (auto c = 0u; c < TILE_COLUMNS; ++c)
+			{
+				double lanes[8];
+				_mm512_storeu_pd(lanes, _mm512_add_pd(sums[0][r][c], sums[1][r][c]));
+				dots[r * TILE_COLUMNS + c] = ((lanes[0] + lanes[1]) + (lanes[2] + lanes[3])) + ((lanes[4] + lanes[5]) + (lanes[6] + lanes[7]));
+			}
+		}
+	}
+#endif
+
+	template<unsigned int SIZE>
+	void tileInt8Scalar(const int8_t* const *a, const int8_t* const *b, unsigned int size, int32_t *dots)
+	{
+		if (SIZE)
+			size = SIZE;
+
+		int32_t sums[TILE_ROWS][TILE_COLUMNS] = {};
+		for (auto i = 0u; i < size; ++i)
+		{
+			for (auto r = 0u; r < TILE_ROWS; ++r)
+			{
+				for (auto c = 0u; c < TILE_COLUMNS; ++c)
+					sums[r][c] += a[r][i] * b[c][i];
+			}
+		}
+		for (auto r = 0u; r < TILE_ROWS; ++r)
+		{
+			for (auto c = 0u; c < TILE_COLUMNS; ++c)
+				dots[r * TILE_COLUMNS + c] = sums[r][c];
+		}
+	}
+
+#ifdef TM_DISTANCE_X86
+	template<unsigned int SIZE>
+	__attribute__((target("avx2")))
+	void tileInt8AVX2(const int8_t* const *a, const int8_t* const *b, unsigned int size, int32_t *dots)
+	{
+		if (SIZE)
+			size = SIZE;
+
+		// widened to 16 bits once per vector, then each pair of products is added into a 32-bit lane
+		__m256i sums[TILE_ROWS][TILE_COLUMNS];
+		for (auto r = 0u; r < TILE_ROWS; ++r)
+		{
+			for (auto c = 0u; c < TILE_COLUMNS; ++c)
+				sums[r][c] = _mm256_setzero_si256();
+		}
+		auto i = 0u;
+		for (; i + 16 <= size; i += 16)
+		{
+			__m256i rows[TILE_ROWS];
+			for (auto r = 0u; r < TILE_ROWS; ++r)
+				rows[r] = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i*)(a[r] + i)));
+			for (auto c = 0u; c < TILE_COLUMNS; ++c)
+			{
+				const __m256i column = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i*)(b[c] + i)));
+				for (auto r = 0u; r < TILE_ROWS; ++r)
+					sums[r][c] = _mm256_add_epi32(sums[r][c], _mm256_madd_epi16(rows[r], column));
+			}
+		}
+
+		int32_t lanes[8];
+		for (auto r = 0u; r < TILE_ROWS; ++r)
+		{
+			for (auto c = 0u; c < TILE_COLUMNS; ++c)
+			{
+				_mm256_storeu_si256((__m256i*)lanes, sums[r][c]);
+				int32_t dot = ((lanes[0] + lanes[1]) + (lanes[2] + lanes[3])) + ((lanes[4] + lanes[5]) + (lanes[6] + lanes[7]));
+				for (auto j = i; j < size; ++j)
+					dot += a[r][j] * b[c][j];
+				dots[r * TILE_COLUMNS + c] = dot;
+			}
+		}
+	}
+#endif
+
+	// picks the widest kernel this CPU supports, specialized for the common word2vec sizes
+	DotProduct selectDotProduct(unsigned int size, const char **name = nullptr)
+	{
+		#define TM_SPECIALIZE(kernel) (size == 128 ? kernel<128> : size == 300 ? kernel<300> : kernel<0>)
+		const char *ignored;
+		if (!name)
+			name = &ignored;
+
+#ifdef TM_DISTANCE_X86
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx512f"))
+		{
+			*name = "avx512";
+			return TM_SPECIALIZE(dotAVX512);
+		}
+		if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+		{
+			*name = "avx2";
+			return TM_SPECIALIZE(dotAVX2);
+		}
+		if (__builtin_cpu_supports("sse2"))
+		{
+			*name = "sse2";
+			return TM_SPECIALIZE(dotSSE2);
+		}
+#endif
+		*name = "scalar";
+		return TM_SPECIALIZE(dotScalar);
+		#undef TM_SPECIALIZE
+	}
+
+	// the block kernel of the instruction set selectDotProduct picks
+	DotProductBlock selectDotProductBlock(unsigned int size)
+	{
+		#define TM_SPECIALIZE(tile) (size == 128 ? dotBlock<double, double, tile<128>> \
+			: size == 300 ? dotBlock<double, double, tile<300>> : dotBlock<double, double, tile<0>>)
+#ifdef TM_DISTANCE_X86
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx512f"))
+			return TM_SPECIALIZE(tileAVX512);
+		if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+			return TM_SPECIALIZE(tileAVX2);
+		if (__builtin_cpu_supports("sse2"))
+			return TM_SPECIALIZE(tileSSE2);
+#endif
+		return TM_SPECIALIZE(tileScalar);
+		#undef TM_SPECIALIZE
+	}
+
+	QuantizedDotProduct selectQuantizedDotProduct(unsigned int size, const char **name = nullptr)
+	{
+		#define TM_SPECIALIZE(kernel) (size == 128 ? kernel<128> : size == 300 ? kernel<300> : kernel<0>)
+		const char *ignored;
+		if (!name)
+			name = &ignored;
+
+#ifdef TM_DISTANCE_X86
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx2"))
+		{
+			*name = "int8 avx2";
+			return TM_SPECIALIZE(dotInt8AVX2);
+		}
+#endif
+		*name = "int8 scalar";
+		return TM_SPECIALIZE(dotInt8Scalar);
+		#undef TM_SPECIALIZE
+	}
+
+	// the block kernel of the instruction set selectQuantizedDotProduct picks
+	QuantizedDotProductBlock selectQuantizedDotProductBlock(unsigned int size)
+	{
+		#define TM_SPECIALIZE(tile) (size == 128 ? dotBlock<int8_t, int32_t, tile<128>> \
+			: size == 300 ? dotBlock<int8_t, int32_t, tile<300>> : dotBlock<int8_t, int32_t, tile<0>>)
+#ifdef TM_DISTANCE_X86
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx2"))
+			return TM_SPECIALIZE(tileInt8AVX2);
+#endif
+		return TM_SPECIALIZE(tileInt8Scalar);
+		#undef TM_SPECIALIZE
+	}
+
+	double norm(const std::vector<double> &v)
+	{
+		return std::sqrt(dotScalar<0>(v.data(), v.data(), v.size()));
+	}
+}
@@ -0,0 +1,365 @@
+#pragma once
+
+#include <map>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <iostream>
+#include <algorithm>
+#include <functional>
+#include <unordered_set>
+#include <unordered_map>
+
+#include "mysql_connection.h"
+
+#include <cppconn/exception.h>
+#include <cppconn/prepared_statement.h>
+#include <cppconn/resultset.h>
+#include <cppconn/statement.h>
+
+#include "tweet.h"
+
+using namespace std;
+
+// keeps a pair of events and event_tweets tables in step with the clusters of each period;
+// clusters keep the id of the event most of their tweets were written under last time, so only events whose
+// tweets changed are rewritten, in one transaction of batched prepared statements readers never see half of;
+// a write can be split into preparing a batch from the clusters and committing it, which then needs nothing from
+// the tweets anymore and can go out on another thread, so long as a batch is committed before the next is prepared
+class EventWriter
+{
+public:
+	struct Report
+	{
+		size_t events = 0, tweets = 0, removed = 0, unchanged = 0;
+		double seconds = 0;
+		bool failed = false;
+	};
+
+private:
+	static const size_t ROWS_PER_STATEMENT = 256;
+
+	struct Event
+	{
+		unsigned long long id = 0;
+		const vector<Tweet*>* tweets;
+		double lon = 0, lat = 0;
+		unsigned int start_time, end_time;
+		size_t users;
+		uint64_t fingerprint;
+	};
+
+public:
+	// a period's write, with everything it needs copied out of the tweets
+	struct Batch
+	{
+		struct EventTweet
+		{
+			unsigned long long event_id;
+			double lat, lon;
+			unsigned int time;
+			bool exact;
+			string text;
+		};
+
+		vector<Event> changed; // events to insert or rewrite, their tweets are not read again
+		vector<EventTweet> event_tweets;
+		vector<unsigned long long> stale, removed;
+		unordered_map<unsigned long long, uint64_t> written; // what the tables hold once the batch is committed
+		Report report;
+	};
+
+private:
+	sql::Connection* connection;
+	const unsigned int variant; // the parameter set whose clusters are written, and whose event ids the tweets keep
+	const string events_table, event_tweets_table;
+	map<string, unique_ptr<sql::PreparedStatement>> statements;
+	unordered_map<unsigned long long, uint64_t> written; // event id to the fingerprint of what the tables hold for it
+	unsigned long long last_id = 0;
+	bool synchronized = false; // whether written describes the tables, rather than whatever an earlier run left there
+
+	Event summarize(const vector<Tweet*> &cluster) const;
+	void assignIds(vector<Event> &events);
+	sql::PreparedStatement* getStatement(const string &query);
+	// runs head, then one row per item joined by commas, then tail; bind sets an item's parameters from the index it is given
+	template<class Item>
+	void executeBatched(const string &head, const string &row, const string &tail, const vector<Item> &items,
+		function<void(sql::PreparedStatement*, unsigned int, const Item&)> bind);
+
+public:
+	EventWriter(sql::Connection* connection, unsigned int variant = 0,
+		const string &events_table = "events", const string &event_tweets_table = "event_tweets");
+	// event ids are handed to the tweets as soon as they are assigned; should the commit fail, the next batch starts
+	// over from empty tables anyway, and ids the tables never got count for nothing in the next assignment
+	Batch prepare(const vector<vector<Tweet*>> &clusters);
+	// fills in and returns the batch's report
+	Report commit(Batch &batch);
+	Report write(const vector<vector<Tweet*>> &clusters);
+};
+
+EventWriter::EventWriter(sql::Connection* connection, unsigned int variant,
+	const string &events_table, const string &event_tweets_table)
+	: connection(connection), variant(variant), events_table(events_table), event_tweets_table(event_tweets_table)
+{
+	// ids keep increasing across restarts, so readers never mistake a new event for one they already have
+	unique_ptr<sql::Statement> statement(connection->createStatement());
+	unique_ptr<sql::ResultSet> result(statement->executeQuery("SELECT MAX(id) AS id FROM " + events_table));
+	if (result->next() && !result->isNull("id"))
+		last_id = result->getUInt64("id");
+}
+
+EventWriter::Event EventWriter::summarize(const vector<Tweet*> &cluster) const
+{
+	Event event;
+	event.tweets = &cluster;
+	event.start_time = event.end_time = cluster[0]->time;
+
+	vector<unsigned long long> sequences;
+	unordered_set<string> users;
+	for (const auto &tweet : cluster)
+	{
+		event.lon += tweet->lon;
+		event.lat += tweet->lat;
+		if (tweet->time < event.start_time)
+			event.start_time = tweet->time;
+		if (tweet->time > event.end_time)
+			event.end_time = tweet->time;
+		users.insert(tweet->user);
+		sequences.push_back(tweet->sequence);
+	}
+	event.lon /= cluster.size();
+	event.lat /= cluster.size();
+	event.users = users.size();
+
+	// everything written for an event follows from which tweets are in it
+	sort(sequences.begin(), sequences.end());
+	event.fingerprint = 0xcbf29ce484222325ull;
+	for (const auto &sequence : sequences)
+		event.fingerprint = (event.fingerprint ^ sequence) * 0x100000001b3ull;
+
+	return event;
+}
+
+void EventWriter::assignIds(vector<Event> &events)
+{
+	// every cluster votes with its tweets for the events they were written under, and the strongest claims win; until
+	// the tables are rewritten from scratch, which is before anything else after a restart, any id handed out before
+	// can be claimed, so tweets restored from a snapshot keep their events' ids
+	struct Claim
+	{
+		size_t votes, event;
+		unsigned long long id;
+	};
+	vector<Claim> claims;
+	for (auto i = 0u; i < events.size(); ++i)
+	{
+		unordered_map<unsigned long long, size_t> votes;
+		for (const auto &tweet : *events[i].tweets)
+		{
+			const auto event = tweet->eventId(variant);
+			if (event && (written.count(event) || (!synchronized && event <= last_id)))
+				votes[event]++;
+		}
+		for (const auto &vote : votes)
+			claims.push_back(Claim{vote.second, i, vote.first});
+	}
+	sort(claims.begin(), claims.end(), [](const Claim &a, const Claim &b) {
+		if (a.votes != b.votes)
+			return a.votes > b.votes;
+		if (a.event != b.event)
+			return a.event < b.event;
+		return a.id < b.id;
+	});
+
+	unordered_set<unsigned long long> taken;
+	for (const auto &claim : claims)
+	{
+		if (events[claim.event].id || taken.count(claim.id))
+			continue;
+		events[claim.event].id = claim.id;
+		taken.insert(claim.id);
+	}
+
+	for (auto &event : events)
+	{
+		if (!event.id)
+			event.id = ++last_id;
+	}
+}
+
+sql::PreparedStatement* EventWriter::getStatement(const string &query)
+{
+	auto &statement = statements[query];
+	if (!statement)
+		statement.reset(connection->prepareStatement(query));
+	return statement.get();
+}
+
+template<class Item>
+void EventWriter::executeBatched(const string &head, const string &row, const string &tail, const vector<Item> &items,
+	function<void(sql::PreparedStatement*, unsigned int, const Item&)> bind)
+{
+	const auto parameters_per_row = count(row.begin(), row.end(), '?');
+	for (size_t begin = 0; begin < items.size(); begin += ROWS_PER_STATEMENT)
+	{
+		const auto end = min(items.size(), begin + ROWS_PER_STATEMENT);
+
+		// full batches all share one statement, only the last partial one is prepared on its own
+		string query = head;
+		for (auto i = begin; i < end; ++i)
+			query += (i == begin ? "" : ",") + row;
+		query += tail;
+
+		auto statement = getStatement(query);
+		for (auto i = begin; i < end; ++i)
+			bind(statement, (i - begin) * parameters_per_row + 1, items[i]);
+		statement->execute();
+
+		if (end - begin < ROWS_PER_STATEMENT)
+			statements.erase(query);
+	}
+}
+
+EventWriter::Batch EventWriter::prepare(const vector<vector<Tweet*>> &clusters)
+{
+	const auto start = chrono::steady_clock::now();
+	Batch batch;
+	auto &report = batch.report;
+
+	vector<Event> events;
+	for (const auto &cluster : clusters)
+	{
+		if (!cluster.empty())
+			events.push_back(summarize(cluster));
+	}
+	assignIds(events);
+
+	for (const auto &event : events)
+	{
+		batch.written[event.id] = event.fingerprint;
+		const auto previous = written.find(event.id);
+		if (synchronized && previous != written.end() && previous->second == event.fingerprint)
+		{
+			report.unchanged++;
+			continue;
+		}
+
+		// tweets are placed at the center of their event
+		for (const auto &tweet : *event.tweets)
+			batch.event_tweets.push_back(Batch::EventTweet{event.id, event.lat, event.lon, tweet->time, tweet->exact, tweet->text});
+		report.tweets += event.tweets->size();
+		if (previous != written.end())
+			batch.stale.push_back(event.id); // its tweets have to go, because they changed
+		batch.changed.push_back(event);
+	}
+	report.events = batch.changed.size();
+
+	for (const auto &event : written)
+	{
+		if (!batch.written.count(event.first))
+			batch.removed.push_back(event.first);
+	}
+	batch.stale.insert(batch.stale.end(), batch.removed.begin(), batch.removed.end());
+	report.removed = batch.removed.size();
+
+	for (const auto &event : events)
+	{
+		for (const auto &tweet : *event.tweets)
+			tweet->eventId(variant) = event.id;
+	}
+
+	report.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	return batch;
+}
+
+EventWriter::Report EventWriter::commit(Batch &batch)
+{
+	const auto start = chrono::steady_clock::now();
+	auto &report = batch.report;
+
+	try
+	{
+		connection->setAutoCommit(false);
+
+		if (!synchronized)
+		{
+			unique_ptr<sql::Statement> statement(connection->createStatement());
+			statement->execute("DELETE FROM " + event_tweets_table);
+			statement->execute("DELETE FROM " + events_table);
+		}
+		else
+		{
+			executeBatched<unsigned long long>("DELETE FROM " + event_tweets_table + " WHERE event_id IN (", "?", ")", batch.stale,
+				[](sql::PreparedStatement* statement, unsigned int first, const unsigned long long &id) {
+					statement->setUInt64(first, id);
+				});
+			executeBatched<unsigned long long>("DELETE FROM " + events_table + " WHERE id IN (", "?", ")", batch.removed,
+				[](sql::PreparedStatement* statement, unsigned int first, const unsigned long long &id) {
+					statement->setUInt64(first, id);
+				});
+		}
+
+		executeBatched<Event>(
+			"INSERT INTO " + events_table + " (`id`, `lon`, `lat`, `start_time`, `end_time`, `users`) VALUES ",
+			"(?, ?, ?, FROM_UNIXTIME(?), FROM_UNIXTIME(?), ?)",
+			" ON DUPLICATE KEY UPDATE `lon` = VALUES(`lon`), `lat` = VALUES(`lat`), `start_time` = VALUES(`start_time`),"
+				" `end_time` = VALUES(`end_time`), `users` = VALUES(`users`)",
+			batch.changed,
+			[](sql::PreparedStatement* statement, unsigned int first, const Event &event) {
+				statement->setUInt64(first, event.id);
+				statement->setDouble(first + 1, event.lon);
+				statement->setDouble(first + 2, event.lat);
+				statement->setUInt(first + 3, event.start_time);
+				statement->setUInt(first + 4, event.end_time);
+				statement->setUInt(first + 5, event.users);
+			});
+
+		executeBatched<Batch::EventTweet>(
+			"INSERT INTO " + event_tweets_table + " (`event_id`, `time`, `lat`, `lon`, `exact`, `text`) VALUES ",
+			"(?, FROM_UNIXTIME(?), ?, ?, ?, ?)",
+			"",
+			batch.event_tweets,
+			[](sql::PreparedStatement* statement, unsigned int first, const Batch::EventTweet &event_tweet) {
+				statement->setUInt64(first, event_tweet.event_id);
+				statement->setUInt(first + 1, event_tweet.time);
+				statement->setDouble(first + 2, event_tweet.lat);
+				statement->setDouble(first + 3, event_tweet.lon);
+				statement->setBoolean(first + 4, event_tweet.exact);
+				statement->setString(first + 5, event_tweet.text);
+			});
+
+		connection->commit();
+		connection->setAutoCommit(true);
+	}
+	catch (sql::SQLException &e)
+	{
+		cerr << "writing events failed, rolling back: " << e.what() << endl;
+		try
+		{
+			connection->rollback();
+			connection->setAutoCommit(true);
+		}
+		catch (sql::SQLException &) {}
+
+		// the next write starts over from empty tables rather than trusting what is there
+		synchronized = false;
+		statements.clear();
+		report.failed = true;
+		report.seconds += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+		return report;
+	}
+
+	written.swap(batch.written);
+	synchronized = true;
+
+	report.seconds += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	return report;
+}
+
+EventWriter::Report EventWriter::write(const vector<vector<Tweet*>> &clusters)
+{
+	auto batch = prepare(clusters);
+	return commit(batch);
+}
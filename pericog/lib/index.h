@@ -0,0 +1,470 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <array>
+#include <atomic>
+#include <memory>
+#include <utility>
+#include <mutex>
+#include <random>
+#include <cassert>
+#include <cmath>
+#include <algorithm>
+#include <unordered_set>
+#include <unordered_map>
+
+#include "distance.h"
+#include "tweet.h"
+
+using namespace std;
+
+struct Cell
+{
+	unordered_map<uint32_t, unordered_set<Tweet*>> tweets_by_word;
+	unordered_map<uint64_t, unordered_set<Tweet*>> tweets_by_hash;
+
+	bool empty() const
+	{
+		return tweets_by_word.empty() && tweets_by_hash.empty();
+	}
+};
+
+// the cells of the [grid] box, each allocated only while tweets are in it; a tweet's region is every cell within
+// regional_radius of its own, either a circle or the square around it, and is worked out from a list of offsets
+// rather than stored for every cell
+class CellGrid
+{
+	int first_x, first_y, width, height, reach;
+	vector<unique_ptr<Cell>> cells;
+	vector<pair<int, int>> region;
+	atomic<size_t> allocated;
+
+	int getIndex(unsigned int x, unsigned int y) const;
+
+public:
+	CellGrid(double west, double east, double south, double north, double cell_size, double regional_radius, bool circular);
+	// whether the tweet's cell lies inside the box; tweets outside it are never indexed
+	bool contains(const Tweet* tweet) const;
+	// the tweet's cell, allocated on first use; the caller must hold the lock for the tweet's cell
+	Cell &getCell(const Tweet* tweet);
+	// frees the tweet's cell once nothing is left in it; the caller must hold the lock for the tweet's cell
+	void releaseCell(const Tweet* tweet);
+	// calls visit with every allocated cell in the tweet's region
+	template<class Visit>
+	void forRegion(const Tweet* tweet, Visit visit) const;
+	template<class Visit>
+	void forEachCell(Visit visit);
+	// with the box cut into columns by rows tiles of whole cells: the tile holding the tweet's cell, and every tile
+	// the square around the tweet's region overlaps; tiles are numbered row by row from the south west
+	unsigned int getTile(const Tweet* tweet, unsigned int columns, unsigned int rows) const;
+	template<class Visit>
+	void forRegionTiles(const Tweet* tweet, unsigned int columns, unsigned int rows, Visit visit) const;
+	size_t getRegionSize() const;
+	size_t getAllocated() const;
+};
+
+CellGrid::CellGrid(double west, double east, double south, double north, double cell_size, double regional_radius, bool circular)
+	: allocated(0)
+{
+	// cells are numbered from the south pole and the antimeridian, as Tweet::clean numbers them
+	first_x = floor((west + MAX_DEGREES_LONGITUDE)/cell_size);
+	first_y = floor((south + MAX_DEGREES_LATITUDE)/cell_size);
+	width = floor((east + MAX_DEGREES_LONGITUDE)/cell_size) - first_x + 1;
+	height = floor((north + MAX_DEGREES_LATITUDE)/cell_size) - first_y + 1;
+	assert(width > 0 && height > 0);
+	cells.resize((size_t)width * height);
+
+	// a circle keeps the cells whose centers are within the radius of the center of the tweet's cell
+	const double radius = regional_radius/cell_size;
+	reach = ceil(radius - 1e-9);
+	for (auto i = -reach; i <= reach; ++i)
+	{
+		for (auto j = -reach; j <= reach; ++j)
+		{
+			if (!circular || i*i + j*j <= radius*radius + 1e-9)
+				region.emplace_back(i, j);
+		}
+	}
+}
+
+int CellGrid::getIndex(unsigned int x, unsigned int y) const
+{
+	const int i = (int)x - first_x, j = (int)y - first_y;
+	if (i < 0 || j < 0 || i >= width || j >= height)
+		return -1;
+	return i * height + j;
+}
+
+bool CellGrid::contains(const Tweet* tweet) const
+{
+	return getIndex(tweet->x, tweet->y) >= 0;
+}
+
+Cell &CellGrid::getCell(const Tweet* tweet)
+{
+	auto &cell = cells[getIndex(tweet->x, tweet->y)];
+	if (!cell)
+	{
+		cell.reset(new Cell());
+		allocated++;
+	}
+	return *cell;
+}
+
+void CellGrid::releaseCell(const Tweet* tweet)
+{
+	auto &cell = cells[getIndex(tweet->x, tweet->y)];
+	if (cell && cell->empty())
+	{
+		cell.reset();
+		allocated--;
+	}
+}
+
+template<class Visit>
+void CellGrid::forRegion(const Tweet* tweet, Visit visit) const
+{
+	// regions end at the edges of the box
+	for (const auto &offset : region)
+	{
+		const int index = getIndex(tweet->x + offset.first, tweet->y + offset.second);
+		if (index >= 0 && cells[index])
+			visit(*cells[index]);
+	}
+}
+
+template<class Visit>
+void CellGrid::forEachCell(Visit visit)
+{
+	for (auto &cell : cells)
+	{
+		if (cell)
+			visit(*cell);
+	}
+}
+
+unsigned int CellGrid::getTile(const Tweet* tweet, unsigned int columns, unsigned int rows) const
+{
+	assert(columns <= (unsigned int)width && rows <= (unsigned int)height);
+	const int i = (int)tweet->x - first_x, j = (int)tweet->y - first_y;
+	return (j * (int)rows / height) * columns + i * (int)columns / width;
+}
+
+template<class Visit>
+void CellGrid::forRegionTiles(const Tweet* tweet, unsigned int columns, unsigned int rows, Visit visit) const
+{
+	const int i = (int)tweet->x - first_x, j = (int)tweet->y - first_y;
+	const int first_column = max(0, i - reach) * (int)columns / width, last_column = min(width - 1, i + reach) * (int)columns / width;
+	const int first_row = max(0, j - reach) * (int)rows / height, last_row = min(height - 1, j + reach) * (int)rows / height;
+	for (auto row = first_row; row <= last_row; ++row)
+	{
+		for (auto column = first_column; column <= last_column; ++column)
+			visit((unsigned int)(row * columns + column));
+	}
+}
+
+size_t CellGrid::getRegionSize() const
+{
+	return region.size();
+}
+
+size_t CellGrid::getAllocated() const
+{
+	return allocated;
+}
+
+// finds the tweets in the window that might lie within epsilon of a new tweet;
+// candidates are always checked with getDistance afterwards, so an index only has to be fast and not miss much
+//
+// insert and erase may be called from many threads at once, cells are guarded by striped locks;
+// query takes no locks, so it may only run alongside other queries
+class NeighborIndex
+{
+	mutable array<mutex, 256> cell_locks;
+
+protected:
+	CellGrid &grid;
+
+	mutex &getCellLock(const Tweet* tweet) const
+	{
+		return cell_locks[(tweet->x * 7919 + tweet->y) % cell_locks.size()];
+	}
+
+public:
+	NeighborIndex(CellGrid &grid) : grid(grid) {}
+	virtual ~NeighborIndex() {}
+	virtual void insert(Tweet* tweet) = 0;
+	virtual void erase(Tweet* tweet) = 0;
+	virtual void query(const Tweet* tweet, vector<Tweet*> &candidates) const = 0;
+	// swaps old addresses of tweets for new ones, after the window moved them
+	void relocate(const unordered_map<Tweet*, Tweet*> &moved);
+
+	// keeps the first keep candidates, the cluster cores, and of the rest only the limit most recent tweets that came
+	// before tweet; a limit of 0 keeps everything; returns how many tweets were dropped
+	static size_t capCandidates(const Tweet* tweet, vector<Tweet*> &candidates, size_t keep, size_t limit);
+};
+
+size_t NeighborIndex::capCandidates(const Tweet* tweet, vector<Tweet*> &candidates, size_t keep, size_t limit)
+{
+	if (!limit || candidates.size() <= keep + limit)
+		return 0;
+
+	// only tweets that came before are ever measured, so later ones take up no room under the limit
+	const auto found = candidates.begin() + keep;
+	candidates.erase(remove_if(found, candidates.end(), [&](const Tweet* candidate) {
+		return candidate->sequence >= tweet->sequence;
+	}), candidates.end());
+	sort(candidates.begin() + keep, candidates.end(), [](const Tweet* a, const Tweet* b) { return a->sequence > b->sequence; });
+	candidates.erase(unique(candidates.begin() + keep, candidates.end()), candidates.end());
+	if (candidates.size() <= keep + limit)
+		return 0;
+
+	const auto dropped = candidates.size() - keep - limit;
+	candidates.resize(keep + limit);
+	return dropped;
+}
+
+void NeighborIndex::relocate(const unordered_map<Tweet*, Tweet*> &moved)
+{
+	if (moved.empty())
+		return;
+
+	vector<Tweet*> found;
+	auto repoint = [&](unordered_set<Tweet*> &tweets) {
+		found.clear();
+		for (const auto &tweet : tweets)
+		{
+			if (moved.count(tweet))
+				found.push_back(tweet);
+		}
+		for (const auto &tweet : found)
+		{
+			tweets.erase(tweet);
+			tweets.insert(moved.at(tweet));
+		}
+	};
+
+	grid.forEachCell([&](Cell &cell) {
+		for (auto &tweets_with_word : cell.tweets_by_word)
+			repoint(tweets_with_word.second);
+		for (auto &tweets_with_hash : cell.tweets_by_hash)
+			repoint(tweets_with_hash.second);
+	});
+}
+
+// tweets in the region sharing at least one word
+class WordIndex : public NeighborIndex
+{
+public:
+	WordIndex(CellGrid &grid) : NeighborIndex(grid) {}
+	void insert(Tweet* tweet);
+	void erase(Tweet* tweet);
+	void query(const Tweet* tweet, vector<Tweet*> &candidates) const;
+};
+
+// tweets in the region sharing a random-hyperplane signature in at least one table
+class LshIndex : public NeighborIndex
+{
+	TMDistance::DotProduct dotProduct;
+	unsigned int vector_size, tables, bits;
+	vector<double> hyperplanes;
+
+	vector<uint64_t> hash(const Tweet* tweet) const;
+
+public:
+	LshIndex(CellGrid &grid, TMDistance::DotProduct dotProduct, unsigned int vector_size, unsigned int tables, unsigned int bits);
+	void insert(Tweet* tweet);
+	void erase(Tweet* tweet);
+	void query(const Tweet* tweet, vector<Tweet*> &candidates) const;
+};
+
+void WordIndex::insert(Tweet* tweet)
+{
+	if (!grid.contains(tweet))
+		return;
+
+	lock_guard<mutex> lock(getCellLock(tweet));
+	auto &tweets_by_word = grid.getCell(tweet).tweets_by_word;
+	for (const auto &word : tweet->words)
+	{
+		tweets_by_word[word].insert(tweet);
+	}
+}
+
+void WordIndex::erase(Tweet* tweet)
+{
+	if (!grid.contains(tweet))
+		return;
+
+	lock_guard<mutex> lock(getCellLock(tweet));
+	auto &tweets_by_word = grid.getCell(tweet).tweets_by_word;
+	for (const auto &word : tweet->words)
+	{
+		tweets_by_word[word].erase(tweet);
+		if (tweets_by_word[word].empty())
+			tweets_by_word.erase(word);
+	}
+	grid.releaseCell(tweet);
+}
+
+void WordIndex::query(const Tweet* tweet, vector<Tweet*> &candidates) const
+{
+	grid.forRegion(tweet, [&](const Cell &cell) {
+		if (cell.tweets_by_word.empty())
+			return;
+
+		for (const auto &word : tweet->words)
+		{
+			const auto tweets_with_word = cell.tweets_by_word.find(word);
+			if (tweets_with_word != cell.tweets_by_word.end())
+				candidates.insert(candidates.end(), tweets_with_word->second.begin(), tweets_with_word->second.end());
+		}
+	});
+}
+
+LshIndex::LshIndex(CellGrid &grid, TMDistance::DotProduct dotProduct, unsigned int vector_size, unsigned int tables, unsigned int bits)
+	: NeighborIndex(grid), dotProduct(dotProduct), vector_size(vector_size), tables(tables), bits(bits)
+{
+	assert(bits > 0 && bits <= 32);
+
+	// a fixed seed keeps bucket assignments identical across restarts
+	mt19937 generator(0x7415);
+	normal_distribution<double> distribution;
+	hyperplanes.resize(tables * bits * vector_size);
+	for (auto &component : hyperplanes)
+	{
+		component = distribution(generator);
+	}
+}
+
+vector<uint64_t> LshIndex::hash(const Tweet* tweet) const
+{
+	// one key per table: the table number in the high bits, the side of each of its hyperplanes in the low bits
+	vector<uint64_t> keys;
+	keys.reserve(tables);
+	const double *hyperplane = hyperplanes.data();
+	for (auto table = 0u; table < tables; ++table)
+	{
+		uint64_t key = uint64_t(table) << 32;
+		for (auto bit = 0u; bit < bits; ++bit, hyperplane += vector_size)
+		{
+			if (dotProduct(hyperplane, tweet->getFeatures(), vector_size) >= 0)
+				key |= uint64_t(1) << bit;
+		}
+		keys.push_back(key);
+	}
+	return keys;
+}
+
+void LshIndex::insert(Tweet* tweet)
+{
+	if (!grid.contains(tweet))
+		return;
+
+	const auto keys = hash(tweet);
+	lock_guard<mutex> lock(getCellLock(tweet));
+	auto &tweets_by_hash = grid.getCell(tweet).tweets_by_hash;
+	for (const auto &key : keys)
+	{
+		tweets_by_hash[key].insert(tweet);
+	}
+}
+
+void LshIndex::erase(Tweet* tweet)
+{
+	if (!grid.contains(tweet))
+		return;
+
+	const auto keys = hash(tweet);
+	lock_guard<mutex> lock(getCellLock(tweet));
+	auto &tweets_by_hash = grid.getCell(tweet).tweets_by_hash;
+	for (const auto &key : keys)
+	{
+		tweets_by_hash[key].erase(tweet);
+		if (tweets_by_hash[key].empty())
+			tweets_by_hash.erase(key);
+	}
+	grid.releaseCell(tweet);
+}
+
+void LshIndex::query(const Tweet* tweet, vector<Tweet*> &candidates) const
+{
+	const auto keys = hash(tweet);
+	grid.forRegion(tweet, [&](const Cell &cell) {
+		if (cell.tweets_by_hash.empty())
+			return;
+
+		for (const auto &key : keys)
+		{
+			const auto tweets_with_hash = cell.tweets_by_hash.find(key);
+			if (tweets_with_hash != cell.tweets_by_hash.end())
+				candidates.insert(candidates.end(), tweets_with_hash->second.begin(), tweets_with_hash->second.end());
+		}
+	});
+}
+
+// what searchNeighbors went through, summed up by its callers
+struct SearchCounts
+{
+	uint64_t examined = 0, capped = 0, screened = 0, computed = 0;
+
+	SearchCounts &operator+=(const SearchCounts &other)
+	{
+		examined += other.examined;
+		capped += other.capped;
+		screened += other.screened;
+		computed += other.computed;
+		return *this;
+	}
+};
+
+// the search every new tweet goes through, in a single process and in the shard workers alike: the cluster cores and
+// whatever index finds near tweet are the candidates, capped as capCandidates does, and those that came before tweet
+// are screened when there is a quantized kernel and measured; the ones within epsilon are appended to neighbors in
+// address order; row is tweet's row in core_distances, candidates is only scratch space kept across calls
+void searchNeighbors(const Tweet* tweet, size_t row, vector<Tweet*> &candidates, const CoreDistances &core_distances,
+	const NeighborIndex &index, const vector<Tweet*> &cores, TMDistance::DotProduct dotProduct,
+	TMDistance::QuantizedDotProduct quantizedDotProduct, unsigned int vector_size, double epsilon, unsigned int candidate_cap,
+	vector<Neighbor> &neighbors, SearchCounts &counts)
+{
+	candidates = cores;
+	index.query(tweet, candidates);
+	counts.capped += NeighborIndex::capCandidates(tweet, candidates, cores.size(), candidate_cap);
+
+	// in address order, so the scan reads forward through sealed slices
+	sort(candidates.begin(), candidates.end());
+	candidates.erase(unique(candidates.begin(), candidates.end()), candidates.end());
+	counts.examined += candidates.size();
+
+	// only pairs within epsilon are kept, everything else is forgotten as soon as it is measured
+	for (const auto &candidate : candidates)
+	{
+		if (candidate->sequence >= tweet->sequence)
+			continue;
+
+		// the exact distance is still what gets kept, screening only skips pairs that cannot be within epsilon
+		double distance;
+		if (core_distances.isCore(*candidate))
+		{
+			if (!core_distances.mayBeWithin(*candidate, row, *tweet, epsilon))
+			{
+				counts.screened++;
+				continue;
+			}
+			distance = core_distances.getDistance(*candidate, row, *tweet);
+		}
+		else
+		{
+			if (quantizedDotProduct && !mayBeWithin(*candidate, *tweet, epsilon, quantizedDotProduct, vector_size))
+			{
+				counts.screened++;
+				continue;
+			}
+			distance = getDistance(*candidate, *tweet, dotProduct, vector_size);
+		}
+		counts.computed++;
+		if (distance <= epsilon)
+			neighbors.push_back(Neighbor{candidate, (float)distance});
+	}
+}
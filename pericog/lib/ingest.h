@@ -0,0 +1,281 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <cstdio>
+#include <algorithm>
+#include <iostream>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "bounded_queue.h"
+
+using namespace std;
+
+// tweets that arrived ahead of the period that takes them, parsed and waiting in a bounded queue for the main thread
+class IngestQueue
+{
+public:
+	struct Record
+	{
+		uint64_t id;
+		unsigned int time;
+		double lat, lon;
+		string text, user;
+		vector<double> feature_vector;
+	};
+
+protected:
+	BoundedQueue<Record> queue;
+	atomic<unsigned long> rejected;
+
+public:
+	IngestQueue(size_t capacity);
+	virtual ~IngestQueue() {}
+	// moves up to limit received records onto the end of records without waiting, and returns how many were moved
+	size_t take(vector<Record> &records, size_t limit);
+	size_t pending();
+	// records that arrived but did not hold a valid tweet
+	unsigned long getRejected() const;
+};
+
+IngestQueue::IngestQueue(size_t capacity)
+	: queue(capacity), rejected(0)
+{}
+
+size_t IngestQueue::take(vector<Record> &records, size_t limit)
+{
+	return queue.popAll(records, limit);
+}
+
+size_t IngestQueue::pending()
+{
+	return queue.size();
+}
+
+unsigned long IngestQueue::getRejected() const
+{
+	return rejected;
+}
+
+// receives tweets pushed by producers over a unix domain socket, as a stream of records in native byte order:
+//   uint32 length of the rest of the record
+//   uint64 tweet id, uint32 unix time, float64 lat, float64 lon
+//   uint32 text length, then the text as UTF-8
+//   uint32 user length, then the id of the user who sent it as UTF-8
+//   uint32 vector size, then that many float64
+// a reader thread parses records into a bounded queue; once it is full the reader stops reading,
+// the socket buffers fill and producers block in send until pericog catches up
+class IngestSocket : public IngestQueue
+{
+	static const uint32_t MAX_RECORD_LENGTH = 1 << 20;
+
+	string path;
+	unsigned int vector_size;
+	int listener = -1, wake[2] = {-1, -1};
+	thread reader;
+
+	void loop();
+	bool parse(const char* data, size_t length, Record &record) const;
+
+public:
+	IngestSocket(const string &path, unsigned int vector_size, size_t capacity);
+	~IngestSocket();
+	// whether the socket could be bound; if not, nothing will ever be received
+	bool isOpen() const;
+};
+
+IngestSocket::IngestSocket(const string &path, unsigned int vector_size, size_t capacity)
+	: IngestQueue(capacity), path(path), vector_size(vector_size)
+{
+	sockaddr_un address;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	if (path.size() >= sizeof(address.sun_path))
+	{
+		cerr << "ingest socket path too long: " << path << endl;
+		return;
+	}
+	strcpy(address.sun_path, path.c_str());
+
+	listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (listener < 0 || pipe(wake) < 0)
+	{
+		perror("ingest socket");
+		if (listener >= 0)
+			close(listener);
+		listener = -1;
+		return;
+	}
+
+	// a socket file left behind by an earlier run would make bind fail
+	unlink(path.c_str());
+	if (bind(listener, (sockaddr*)&address, sizeof(address)) < 0 || listen(listener, 16) < 0)
+	{
+		perror(("ingest socket " + path).c_str());
+		close(listener);
+		listener = -1;
+		return;
+	}
+
+	reader = thread(&IngestSocket::loop, this);
+}
+
+IngestSocket::~IngestSocket()
+{
+	if (reader.joinable())
+	{
+		// wake the reader whether it is waiting on the sockets or on a full queue
+		queue.close();
+		const char stop = 0;
+		if (write(wake[1], &stop, 1) < 0)
+			perror("ingest socket");
+		reader.join();
+	}
+
+	if (listener >= 0)
+	{
+		close(listener);
+		unlink(path.c_str());
+	}
+	for (const auto &fd : wake)
+	{
+		if (fd >= 0)
+			close(fd);
+	}
+}
+
+bool IngestSocket::isOpen() const
+{
+	return listener >= 0;
+}
+
+void IngestSocket::loop()
+{
+	struct Client
+	{
+		int fd;
+		string buffer;
+	};
+	vector<Client> clients;
+	vector<char> chunk(1 << 16);
+
+	while (true)
+	{
+		vector<pollfd> fds{{wake[0], POLLIN, 0}, {listener, POLLIN, 0}};
+		for (const auto &client : clients)
+			fds.push_back(pollfd{client.fd, POLLIN, 0});
+
+		if (poll(fds.data(), fds.size(), -1) < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			perror("ingest socket");
+			break;
+		}
+		if (fds[0].revents)
+			break;
+
+		if (fds[1].revents & POLLIN)
+		{
+			const int fd = accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+			if (fd >= 0)
+				clients.push_back(Client{fd, ""});
+		}
+
+		bool stopping = false;
+		for (auto i = 0u; i + 2 < fds.size(); ++i)
+		{
+			auto &client = clients[i];
+			if (!fds[i + 2].revents)
+				continue;
+
+			const auto received = read(client.fd, chunk.data(), chunk.size());
+			if (received <= 0)
+			{
+				close(client.fd);
+				client.fd = -1;
+				continue;
+			}
+			client.buffer.append(chunk.data(), received);
+
+			// hand every complete record to the queue, keeping a partial one for the next read
+			size_t offset = 0;
+			while (client.buffer.size() - offset >= sizeof(uint32_t))
+			{
+				uint32_t length;
+				memcpy(&length, client.buffer.data() + offset, sizeof(length));
+				if (length > MAX_RECORD_LENGTH)
+				{
+					// the stream cannot be resynchronized, so the producer has to reconnect
+					cerr << "ingest socket: dropping a producer that sent a " << length << " byte record" << endl;
+					close(client.fd);
+					client.fd = -1;
+					break;
+				}
+				if (client.buffer.size() - offset - sizeof(length) < length)
+					break;
+
+				Record record;
+				if (!parse(client.buffer.data() + offset + sizeof(length), length, record))
+					rejected++;
+				else if (!queue.push(move(record)))
+					stopping = true;
+				offset += sizeof(length) + length;
+			}
+			client.buffer.erase(0, offset);
+		}
+		if (stopping)
+			break;
+
+		clients.erase(remove_if(clients.begin(), clients.end(), [](const Client &client) { return client.fd < 0; }), clients.end());
+	}
+
+	for (const auto &client : clients)
+	{
+		if (client.fd >= 0)
+			close(client.fd);
+	}
+}
+
+bool IngestSocket::parse(const char* data, size_t length, Record &record) const
+{
+	const char* end = data + length;
+	auto consume = [&](void* value, size_t size) {
+		if ((size_t)(end - data) < size)
+			return false;
+		memcpy(value, data, size);
+		data += size;
+		return true;
+	};
+
+	uint32_t text_length, user_length, size;
+	if (!consume(&record.id, sizeof(record.id))
+	|| !consume(&record.time, sizeof(uint32_t))
+	|| !consume(&record.lat, sizeof(double))
+	|| !consume(&record.lon, sizeof(double))
+	|| !consume(&text_length, sizeof(text_length))
+	|| (size_t)(end - data) < text_length)
+		return false;
+
+	record.text.assign(data, text_length);
+	data += text_length;
+
+	if (!consume(&user_length, sizeof(user_length)) || (size_t)(end - data) < user_length)
+		return false;
+	record.user.assign(data, user_length);
+	data += user_length;
+
+	if (!consume(&size, sizeof(size)) || size != vector_size)
+		return false;
+
+	record.feature_vector.resize(size);
+	return consume(record.feature_vector.data(), size * sizeof(double)) && data == end;
+}
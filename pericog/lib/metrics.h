@@ -0,0 +1,157 @@
+#pragma once
+
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdint>
+#include <sstream>
+#include <fstream>
+#include <iostream>
+
+using namespace std;
+
+// counters, gauges and histograms, written out in the Prometheus text format for node_exporter's textfile collector;
+// labels are passed preformatted, as in stage="getClusters"
+class Metrics
+{
+public:
+	typedef atomic<uint64_t> Counter;
+
+private:
+	struct Histogram
+	{
+		vector<uint64_t> buckets;
+		uint64_t count = 0;
+		double sum = 0;
+	};
+
+	struct Family
+	{
+		string type, help;
+		map<string, unique_ptr<Counter>> counters;
+		map<string, double> gauges;
+		map<string, Histogram> histograms;
+	};
+
+	// seconds, from a fast stage up to a period that overran by a lot
+	const vector<double> bounds{.001, .0025, .005, .01, .025, .05, .1, .25, .5, 1, 2.5, 5, 10, 30, 60, 120, 300};
+
+	mutable mutex lock;
+	map<string, Family> families;
+
+	Family &getFamily(const string &name, const string &type, const string &help);
+	static string getName(const string &name, const string &labels, const string &suffix = "", const string &extra_label = "");
+
+public:
+	// counters are never removed, so hot loops look one up once and add to it without taking any lock
+	Counter &counter(const string &name, const string &help, const string &labels = "");
+	void set(const string &name, const string &help, double value, const string &labels = "");
+	void observe(const string &name, const string &help, double seconds, const string &labels = "");
+	string format() const;
+	// writes next to path and renames over it, so the collector never reads a half-written file
+	bool write(const string &path) const;
+};
+
+Metrics::Family &Metrics::getFamily(const string &name, const string &type, const string &help)
+{
+	auto &family = families[name];
+	if (family.type.empty())
+	{
+		family.type = type;
+		family.help = help;
+	}
+	return family;
+}
+
+string Metrics::getName(const string &name, const string &labels, const string &suffix, const string &extra_label)
+{
+	const string all_labels = labels + (!labels.empty() && !extra_label.empty() ? "," : "") + extra_label;
+	return name + suffix + (all_labels.empty() ? "" : "{" + all_labels + "}");
+}
+
+Metrics::Counter &Metrics::counter(const string &name, const string &help, const string &labels)
+{
+	lock_guard<mutex> guard(lock);
+	auto &counter = getFamily(name, "counter", help).counters[labels];
+	if (!counter)
+		counter.reset(new Counter(0));
+	return *counter;
+}
+
+void Metrics::set(const string &name, const string &help, double value, const string &labels)
+{
+	lock_guard<mutex> guard(lock);
+	getFamily(name, "gauge", help).gauges[labels] = value;
+}
+
+void Metrics::observe(const string &name, const string &help, double seconds, const string &labels)
+{
+	lock_guard<mutex> guard(lock);
+	auto &histogram = getFamily(name, "histogram", help).histograms[labels];
+	histogram.buckets.resize(bounds.size());
+	for (auto i = 0u; i < bounds.size(); ++i)
+	{
+		if (seconds <= bounds[i])
+		{
+			histogram.buckets[i]++;
+			break;
+		}
+	}
+	histogram.count++;
+	histogram.sum += seconds;
+}
+
+string Metrics::format() const
+{
+	lock_guard<mutex> guard(lock);
+	ostringstream out;
+	out.precision(17);
+	for (const auto &entry : families)
+	{
+		const auto &name = entry.first;
+		const auto &family = entry.second;
+		out << "# HELP " << name << " " << family.help << "\n";
+		out << "# TYPE " << name << " " << family.type << "\n";
+
+		for (const auto &counter : family.counters)
+			out << getName(name, counter.first) << " " << counter.second->load() << "\n";
+		for (const auto &gauge : family.gauges)
+			out << getName(name, gauge.first) << " " << gauge.second << "\n";
+		for (const auto &histogram : family.histograms)
+		{
+			// buckets are kept separately and only summed up here
+			uint64_t cumulative = 0;
+			for (auto i = 0u; i < bounds.size(); ++i)
+			{
+				ostringstream bound;
+				bound << bounds[i];
+				cumulative += histogram.second.buckets[i];
+				out << getName(name, histogram.first, "_bucket", "le=\"" + bound.str() + "\"") << " " << cumulative << "\n";
+			}
+			out << getName(name, histogram.first, "_bucket", "le=\"+Inf\"") << " " << histogram.second.count << "\n";
+			out << getName(name, histogram.first, "_sum") << " " << histogram.second.sum << "\n";
+			out << getName(name, histogram.first, "_count") << " " << histogram.second.count << "\n";
+		}
+	}
+	return out.str();
+}
+
+bool Metrics::write(const string &path) const
+{
+	const string temporary_path = path + ".tmp";
+	ofstream file(temporary_path, ios::trunc);
+	file << format();
+	file.close();
+
+	if (!file || rename(temporary_path.c_str(), path.c_str()))
+	{
+		cerr << "could not write metrics " << path << endl;
+		remove(temporary_path.c_str());
+		return false;
+	}
+	return true;
+}
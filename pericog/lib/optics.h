@@ -0,0 +1,182 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+
+#include "thread_pool.h"
+#include "tweet.h"
+
+using namespace std;
+
+struct OpticsParameters
+{
+	double epsilon;
+	unsigned int minimum_points;
+};
+
+// keeps core and smallest reachability distances current by revisiting only the tweets whose neighborhoods changed;
+// neighbor lists may reach further than a parameter set's epsilon, every set only reads the neighbors within its own
+class OpticsUpdater
+{
+	vector<Tweet*> dirty_tweets;
+
+	void update(ThreadPool &pool, const OpticsParameters &parameters, unsigned int variant);
+
+public:
+	// the tweet gained or lost a neighbor
+	void touch(Tweet* tweet);
+	// flags the tweets expired and removes them from the neighbor lists of the tweets that remain
+	void unlink(ThreadPool &pool, const vector<Tweet*> &expired_tweets);
+	void update(ThreadPool &pool, double epsilon, unsigned int minimum_points);
+	// brings every parameter set up to date, parameters[v] giving the distances of variant v
+	void update(ThreadPool &pool, const vector<OpticsParameters> &parameters);
+	size_t size() const;
+};
+
+void OpticsUpdater::touch(Tweet* tweet)
+{
+	if (tweet->require_update)
+		return;
+
+	tweet->require_update = true;
+	dirty_tweets.push_back(tweet);
+}
+
+void OpticsUpdater::unlink(ThreadPool &pool, const vector<Tweet*> &expired_tweets)
+{
+	for (const auto &tweet : expired_tweets)
+	{
+		tweet->expired = true;
+	}
+
+	// every surviving neighbor is pruned once, however many of its neighbors expired together
+	vector<Tweet*> pruned_tweets;
+	for (const auto &tweet : expired_tweets)
+	{
+		for (const auto &neighbor : tweet->optics_neighbors)
+		{
+			if (!neighbor.tweet->expired)
+				pruned_tweets.push_back(neighbor.tweet);
+		}
+	}
+	sort(pruned_tweets.begin(), pruned_tweets.end());
+	pruned_tweets.erase(unique(pruned_tweets.begin(), pruned_tweets.end()), pruned_tweets.end());
+
+	pool.parallelFor(pruned_tweets.size(), 256, [&](size_t begin, size_t end, unsigned int) {
+		for (auto i = begin; i < end; ++i)
+		{
+			auto &optics_neighbors = pruned_tweets[i]->optics_neighbors;
+			optics_neighbors.erase(remove_if(optics_neighbors.begin(), optics_neighbors.end(),
+				[](const Neighbor &neighbor) { return neighbor.tweet->expired; }), optics_neighbors.end());
+		}
+	});
+
+	for (const auto &tweet : pruned_tweets)
+	{
+		touch(tweet);
+	}
+}
+
+size_t OpticsUpdater::size() const
+{
+	return dirty_tweets.size();
+}
+
+void OpticsUpdater::update(ThreadPool &pool, double epsilon, unsigned int minimum_points)
+{
+	update(pool, {OpticsParameters{epsilon, minimum_points}});
+}
+
+void OpticsUpdater::update(ThreadPool &pool, const vector<OpticsParameters> &parameters)
+{
+	for (auto variant = 0u; variant < parameters.size(); ++variant)
+		update(pool, parameters[variant], variant);
+
+	for (const auto &tweet : dirty_tweets)
+	{
+		tweet->require_update = false;
+	}
+	dirty_tweets.clear();
+}
+
+void OpticsUpdater::update(ThreadPool &pool, const OpticsParameters &parameters, unsigned int variant)
+{
+	const double epsilon = parameters.epsilon;
+	const unsigned int minimum_points = parameters.minimum_points;
+	// distances are stored as floats, and rounding keeps every distance within epsilon within the rounded epsilon
+	const float within = epsilon;
+
+	// tweets whose neighbors' core distances changed, gathered per worker
+	vector<vector<Tweet*>> affected_tweets(pool.size());
+
+	// calculate core distances
+	pool.parallelFor(dirty_tweets.size(), 256, [&](size_t begin, size_t end, unsigned int worker) {
+		for (auto i = begin; i < end; ++i)
+		{
+			const auto &tweet = dirty_tweets[i];
+			auto &core_distance = tweet->coreDistance(variant);
+			const double previous_core_distance = core_distance;
+
+			// non-core objects (borders and noise) are denoted by a core distance greater than epsilon
+			if (tweet->optics_neighbors.size() < minimum_points || tweet->optics_neighbors[minimum_points-1].distance > within)
+				core_distance = epsilon + 1;
+			else
+				core_distance = tweet->optics_neighbors[minimum_points-1].distance;
+
+			// neighbors measure their reachability against this core distance, so a change reaches one step further
+			if (core_distance != previous_core_distance
+			&& (core_distance <= epsilon || previous_core_distance <= epsilon))
+			{
+				for (const auto &neighbor : tweet->optics_neighbors)
+				{
+					if (neighbor.distance > within)
+						break;
+					affected_tweets[worker].push_back(neighbor.tweet);
+				}
+			}
+		}
+	});
+
+	// parallelFor returning is the barrier: every core distance is final before any reachability is read from it
+	vector<Tweet*> reachability_dirty_tweets(dirty_tweets);
+	for (const auto &worker_tweets : affected_tweets)
+	{
+		reachability_dirty_tweets.insert(reachability_dirty_tweets.end(), worker_tweets.begin(), worker_tweets.end());
+	}
+
+	sort(reachability_dirty_tweets.begin(), reachability_dirty_tweets.end());
+	reachability_dirty_tweets.erase(unique(reachability_dirty_tweets.begin(), reachability_dirty_tweets.end()), reachability_dirty_tweets.end());
+
+	// calculate smallest reachability distances
+	pool.parallelFor(reachability_dirty_tweets.size(), 256, [&](size_t begin, size_t end, unsigned int) {
+		for (auto i = begin; i < end; ++i)
+		{
+			const auto &tweet = reachability_dirty_tweets[i];
+			auto &smallest_reachability_distance = tweet->smallestReachabilityDistance(variant);
+
+			// noise is denoted by a smallest reachability distance greater than epsilon
+			smallest_reachability_distance = epsilon + 1;
+
+			for (const auto &neighbor : tweet->optics_neighbors)
+			{
+				if (neighbor.distance > within)
+					break;
+				const auto &optics_neighbor = neighbor.tweet;
+				const double neighbor_core_distance = optics_neighbor->coreDistance(variant);
+
+				// tweet cannot be directly density-reachable from a non-core object
+				if (neighbor_core_distance > epsilon)
+					continue;
+
+				double reachability_distance;
+				if (neighbor.distance > neighbor_core_distance)
+					reachability_distance = neighbor.distance;
+				else
+					reachability_distance = tweet->coreDistance(variant);
+
+				if (smallest_reachability_distance > reachability_distance)
+					smallest_reachability_distance = reachability_distance;
+			}
+		}
+	});
+}
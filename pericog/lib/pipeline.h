@@ -0,0 +1,77 @@
+#pragma once
+
+#include <thread>
+#include <mutex>
+#include <functional>
+#include <condition_variable>
+
+// a stage of the period that runs on a thread of its own, so it can go on while the main thread moves on to the next
+// period; a stage works on one job at a time, and handing it the next one first waits for the one before
+class PipelineStage
+{
+	std::mutex lock;
+	std::condition_variable changed;
+	std::function<void()> job;
+	bool busy = false, stopping = false;
+	std::thread worker;
+
+	void loop();
+
+public:
+	PipelineStage();
+	// finishes the job in hand before returning
+	~PipelineStage();
+
+	// waits for the job before, then hands this one over and returns without waiting for it
+	void submit(std::function<void()> next);
+	// waits for the job handed over last
+	void wait();
+};
+
+PipelineStage::PipelineStage()
+	: worker(&PipelineStage::loop, this)
+{}
+
+PipelineStage::~PipelineStage()
+{
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		stopping = true;
+	}
+	changed.notify_all();
+	worker.join();
+}
+
+void PipelineStage::submit(std::function<void()> next)
+{
+	std::unique_lock<std::mutex> guard(lock);
+	changed.wait(guard, [this]() { return !busy; });
+	job = std::move(next);
+	busy = true;
+	guard.unlock();
+	changed.notify_all();
+}
+
+void PipelineStage::wait()
+{
+	std::unique_lock<std::mutex> guard(lock);
+	changed.wait(guard, [this]() { return !busy; });
+}
+
+void PipelineStage::loop()
+{
+	std::unique_lock<std::mutex> guard(lock);
+	while (true)
+	{
+		changed.wait(guard, [this]() { return busy || stopping; });
+		if (!busy)
+			return;
+
+		guard.unlock();
+		job();
+		guard.lock();
+		job = nullptr;
+		busy = false;
+		changed.notify_all();
+	}
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <ctime>
+#include <cerrno>
+#include <cstdio>
+#include <cstdint>
+#include <chrono>
+#include <thread>
+#include <algorithm>
+#include <unistd.h>
+#include <sys/timerfd.h>
+
+using namespace std;
+
+// decides when each period runs and how much of it is done, from how far the periods have fallen behind the clock;
+// a period is due once the second after its end has begun, and its lag is how long after that it actually starts
+//
+// once a period starts more than degrade_lag seconds late, periods run degraded until one starts within recover_lag;
+// degraded periods are left to skip what can be caught up on later, and the clusters of a degraded period are not
+// extracted at all when the next period is already due, since they would be replaced before anyone saw them, though
+// never for more than max_skipped periods in a row
+class PeriodScheduler
+{
+public:
+	struct Plan
+	{
+		double lag;
+		bool degraded;
+		bool extract; // whether the clusters are extracted and written
+	};
+
+private:
+	unsigned int period;
+	double degrade_lag, recover_lag;
+	unsigned int max_skipped, skipped = 0;
+	bool degraded = false;
+	int timer;
+
+public:
+	PeriodScheduler(unsigned int period, double degrade_lag, double recover_lag, unsigned int max_skipped);
+	~PeriodScheduler();
+
+	// sleeps until the period starting at start is due, on a timer that follows the clock if it is set
+	void wait(unsigned int start);
+	// how the period starting at start runs if it begins at now, in unix time
+	Plan plan(unsigned int start, double now);
+	Plan plan(unsigned int start);
+};
+
+PeriodScheduler::PeriodScheduler(unsigned int period, double degrade_lag, double recover_lag, unsigned int max_skipped)
+	: period(period), degrade_lag(degrade_lag), recover_lag(recover_lag), max_skipped(max_skipped),
+	timer(timerfd_create(CLOCK_REALTIME, TFD_CLOEXEC))
+{
+	if (timer < 0)
+		perror("period timer");
+}
+
+PeriodScheduler::~PeriodScheduler()
+{
+	if (timer >= 0)
+		close(timer);
+}
+
+void PeriodScheduler::wait(unsigned int start)
+{
+	const time_t due = start + period + 1;
+	while (time(nullptr) < due)
+	{
+		if (timer < 0)
+		{
+			this_thread::sleep_until(chrono::system_clock::from_time_t(due));
+			continue;
+		}
+
+		itimerspec deadline{};
+		deadline.it_value.tv_sec = due;
+		if (timerfd_settime(timer, TFD_TIMER_ABSTIME | TFD_TIMER_CANCEL_ON_SET, &deadline, nullptr) < 0)
+		{
+			perror("period timer");
+			this_thread::sleep_until(chrono::system_clock::from_time_t(due));
+			continue;
+		}
+
+		// a clock that was set cancels the wait with ECANCELED, and the deadline is checked against it again
+		uint64_t expirations;
+		if (read(timer, &expirations, sizeof(expirations)) < 0 && errno != ECANCELED && errno != EINTR)
+			perror("period timer");
+	}
+}
+
+PeriodScheduler::Plan PeriodScheduler::plan(unsigned int start, double now)
+{
+	Plan plan;
+	plan.lag = max(0.0, now - (start + period + 1));
+
+	if (!degraded && plan.lag > degrade_lag)
+		degraded = true;
+	else if (degraded && plan.lag <= recover_lag)
+		degraded = false;
+	plan.degraded = degraded;
+
+	const bool next_due = plan.lag >= period;
+	plan.extract = !(degraded && next_due && skipped < max_skipped);
+	skipped = plan.extract ? 0 : skipped + 1;
+	return plan;
+}
+
+PeriodScheduler::Plan PeriodScheduler::plan(unsigned int start)
+{
+	return plan(start, chrono::duration<double>(chrono::system_clock::now().time_since_epoch()).count());
+}
@@ -0,0 +1,538 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <cstdlib>
+#include <iostream>
+#include <algorithm>
+#include <functional>
+#include <unordered_map>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "index.h"
+#include "thread_pool.h"
+#include "window.h"
+#include "tweet.h"
+
+using namespace std;
+
+// pericog spread over processes by area: the [grid] box is cut into columns by rows tiles of whole cells, and the
+// tweets of each tile are indexed and searched for neighbors by a worker process of its own
+//
+// a new tweet goes to the worker whose tile holds its cell, and is mirrored as a halo tweet to every other worker
+// whose tile its region reaches into, so each worker holds every tweet its own tweets can be compared with; workers
+// send back the neighbors of the tweets they own, and the coordinator links them into its window just as it would
+// have found them itself, so OPTICS and cluster extraction run over the whole graph and clusters crossing the
+// borders of tiles come out whole
+//
+// coordinator and workers talk over a unix socket pair each, in messages framed in native byte order:
+//   uint32 type, uint64 length of the rest
+// tweets are sent as
+//   uint64 sequence, uint32 time, uint32 x, uint32 y, uint8 owned
+//   uint32 word count, then that many uint32 word ids
+//   float64[vector_size]
+// a search starts with the uint32 candidate cap, see NeighborIndex::capCandidates, and the reply to it is
+//   uint64 candidates examined, uint64 capped, uint64 screened, uint64 distances computed
+//   for every owned tweet, in the order sent: uint32 neighbor count, then that many uint64 sequence, float32 distance
+namespace TMShards
+{
+	enum MessageType : uint32_t
+	{
+		CORES = 1,  // tweets that are candidates for every tweet, sent once at startup
+		INSERT = 2, // tweets already linked, as after a restart; indexed without searching
+		SEARCH = 3, // new tweets; indexed, then the owned ones are searched and their neighbors sent back
+		EXPIRE = 4, // uint32 cutoff; drops the tweets the window expires
+		SEAL = 5,   // uint32 cutoff; packs the periods that are over
+		RESULT = 6,
+	};
+
+	// one end of a socket pair, with whole messages read and written at a time
+	class Channel
+	{
+		int socket;
+		string out;
+
+		bool readFully(char* data, size_t length);
+
+	public:
+		Channel(int socket) : socket(socket) {}
+		~Channel() { close(socket); }
+		int getSocket() const { return socket; }
+
+		template<class T>
+		void put(const T &value) { out.append((const char*)&value, sizeof(value)); }
+		void put(const void* data, size_t length) { out.append((const char*)data, length); }
+		// sends what was put since the last send as one message; false once the other end is gone
+		bool send(MessageType type);
+		// waits for the next message; false once the other end is gone
+		bool receive(MessageType &type, string &message);
+	};
+
+	// reads values back out of a message in the order they were put
+	class Reader
+	{
+		const string &message;
+		size_t offset = 0;
+
+	public:
+		Reader(const string &message) : message(message) {}
+		template<class T>
+		T get()
+		{
+			T value;
+			memcpy(&value, message.data() + offset, sizeof(value));
+			offset += sizeof(value);
+			return value;
+		}
+		const char* skip(size_t length)
+		{
+			const char* data = message.data() + offset;
+			offset += length;
+			return data;
+		}
+	};
+
+	bool Channel::readFully(char* data, size_t length)
+	{
+		while (length)
+		{
+			const auto received = read(socket, data, length);
+			if (received < 0 && errno == EINTR)
+				continue;
+			if (received <= 0)
+				return false;
+			data += received;
+			length -= received;
+		}
+		return true;
+	}
+
+	bool Channel::send(MessageType type)
+	{
+		const uint32_t message_type = type;
+		const uint64_t length = out.size();
+		string header((const char*)&message_type, sizeof(message_type));
+		header.append((const char*)&length, sizeof(length));
+
+		bool sent = true;
+		for (const auto &part : {&header, &out})
+		{
+			for (size_t offset = 0; sent && offset < part->size(); )
+			{
+				const auto written = ::send(socket, part->data() + offset, part->size() - offset, MSG_NOSIGNAL);
+				if (written < 0 && errno == EINTR)
+					continue;
+				if (written <= 0)
+					sent = false;
+				else
+					offset += written;
+			}
+		}
+		out.clear();
+		return sent;
+	}
+
+	bool Channel::receive(MessageType &type, string &message)
+	{
+		uint32_t message_type;
+		uint64_t length;
+		if (!readFully((char*)&message_type, sizeof(message_type)) || !readFully((char*)&length, sizeof(length)))
+			return false;
+		type = (MessageType)message_type;
+		message.resize(length);
+		return readFully(&message[0], length);
+	}
+
+	// searches one tile; holds its own copies of the tweets, with only what indexing and distances need
+	class Worker
+	{
+		Channel channel;
+		NeighborIndex &index;
+		ThreadPool &pool;
+		TMDistance::DotProduct dotProduct;
+		TMDistance::QuantizedDotProduct quantizedDotProduct; // null unless candidates are screened
+		TMDistance::DotProductBlock dotProductBlock; // null when candidates are screened
+		TMDistance::QuantizedDotProductBlock quantizedDotProductBlock; // null unless candidates are screened
+		unsigned int vector_size;
+		double epsilon;
+		bool morton;
+		Window window;
+		vector<Tweet*> cores;
+
+		vector<Tweet*> receiveTweets(Reader &reader, vector<Tweet*> &owned);
+		void indexTweets(const vector<Tweet*> &tweets);
+		void search(const vector<Tweet*> &owned, unsigned int candidate_cap);
+
+	public:
+		Worker(int socket, NeighborIndex &index, ThreadPool &pool,
+			TMDistance::DotProduct dotProduct, TMDistance::QuantizedDotProduct quantizedDotProduct,
+			TMDistance::DotProductBlock dotProductBlock, TMDistance::QuantizedDotProductBlock quantizedDotProductBlock,
+			unsigned int vector_size, double epsilon, unsigned int period, bool morton);
+		~Worker();
+		// serves the coordinator until it hangs up
+		void run();
+	};
+
+	Worker::Worker(int socket, NeighborIndex &index, ThreadPool &pool,
+		TMDistance::DotProduct dotProduct, TMDistance::QuantizedDotProduct quantizedDotProduct,
+		TMDistance::DotProductBlock dotProductBlock, TMDistance::QuantizedDotProductBlock quantizedDotProductBlock,
+		unsigned int vector_size, double epsilon, unsigned int period, bool morton)
+		: channel(socket), index(index), pool(pool), dotProduct(dotProduct), quantizedDotProduct(quantizedDotProduct),
+		dotProductBlock(dotProductBlock), quantizedDotProductBlock(quantizedDotProductBlock), vector_size(vector_size),
+		epsilon(epsilon), morton(morton), window(period)
+	{}
+
+	Worker::~Worker()
+	{
+		for (const auto &core : cores)
+			delete core;
+	}
+
+	vector<Tweet*> Worker::receiveTweets(Reader &reader, vector<Tweet*> &owned)
+	{
+		const auto count = reader.get<uint32_t>();
+		vector<Tweet*> tweets;
+		tweets.reserve(count);
+		for (auto i = 0u; i < count; ++i)
+		{
+			const auto sequence = reader.get<uint64_t>();
+			const auto time = reader.get<uint32_t>();
+			const auto x = reader.get<uint32_t>(), y = reader.get<uint32_t>();
+			const bool is_owned = reader.get<uint8_t>();
+			const auto word_count = reader.get<uint32_t>();
+			// copied out, nothing in a message is aligned
+			const auto words = reader.skip(word_count * sizeof(uint32_t));
+			const auto features = reader.skip(vector_size * sizeof(double));
+
+			vector<double> feature_vector(vector_size);
+			memcpy(feature_vector.data(), features, vector_size * sizeof(double));
+			auto tweet = window.create(time, 0, 0, "", move(feature_vector));
+			tweet->sequence = sequence;
+			tweet->x = x;
+			tweet->y = y;
+			tweet->words.resize(word_count);
+			memcpy(tweet->words.data(), words, word_count * sizeof(uint32_t));
+
+			tweets.push_back(tweet);
+			if (is_owned)
+				owned.push_back(tweet);
+		}
+		return tweets;
+	}
+
+	void Worker::indexTweets(const vector<Tweet*> &tweets)
+	{
+		pool.parallelFor(tweets.size(), 64, [&](size_t begin, size_t end, unsigned int) {
+			for (auto i = begin; i < end; ++i)
+			{
+				index.insert(tweets[i]);
+				if (quantizedDotProduct)
+					tweets[i]->quantize(vector_size);
+			}
+		});
+	}
+
+	void Worker::search(const vector<Tweet*> &owned, unsigned int candidate_cap)
+	{
+		// the same search updateTweets does in a single process, over this tile and its halo
+		vector<vector<Neighbor>> neighbors(owned.size());
+		vector<SearchCounts> counts(pool.size());
+		pool.parallelFor(owned.size(), 16, [&](size_t begin, size_t end, unsigned int worker) {
+			vector<Tweet*> candidates;
+			CoreDistances core_distances(cores, dotProduct, dotProductBlock, quantizedDotProductBlock, vector_size);
+			core_distances.compute(&owned[begin], end - begin);
+			for (auto i = begin; i < end; ++i)
+			{
+				searchNeighbors(owned[i], i - begin, candidates, core_distances, index, cores, dotProduct, quantizedDotProduct,
+					vector_size, epsilon, candidate_cap, neighbors[i], counts[worker]);
+			}
+		});
+
+		SearchCounts total;
+		for (const auto &count : counts)
+			total += count;
+		channel.put(total.examined);
+		channel.put(total.capped);
+		channel.put(total.screened);
+		channel.put(total.computed);
+		for (const auto &tweet_neighbors : neighbors)
+		{
+			channel.put((uint32_t)tweet_neighbors.size());
+			for (const auto &neighbor : tweet_neighbors)
+			{
+				channel.put((uint64_t)neighbor.tweet->sequence);
+				channel.put(neighbor.distance);
+			}
+		}
+	}
+
+	void Worker::run()
+	{
+		MessageType type;
+		string message;
+		while (channel.receive(type, message))
+		{
+			Reader reader(message);
+			vector<Tweet*> owned;
+			if (type == CORES)
+			{
+				const auto count = reader.get<uint32_t>();
+				for (auto i = 0u; i < count; ++i)
+				{
+					const auto sequence = reader.get<uint64_t>();
+					vector<double> feature_vector(vector_size);
+					memcpy(feature_vector.data(), reader.skip(vector_size * sizeof(double)), vector_size * sizeof(double));
+					cores.push_back(new Tweet(feature_vector));
+					cores.back()->sequence = sequence;
+					if (quantizedDotProduct)
+						cores.back()->quantize(vector_size);
+				}
+			}
+			else if (type == INSERT || type == SEARCH)
+			{
+				const unsigned int candidate_cap = type == SEARCH ? reader.get<uint32_t>() : 0;
+				const auto tweets = receiveTweets(reader, owned);
+				indexTweets(tweets);
+				if (type == SEARCH)
+				{
+					search(owned, candidate_cap);
+					if (!channel.send(RESULT))
+						return;
+				}
+				for (const auto &tweet : tweets)
+					window.insert(tweet);
+			}
+			else if (type == EXPIRE)
+			{
+				const auto expired_tweets = window.expire(reader.get<uint32_t>());
+				pool.parallelFor(expired_tweets.size(), 256, [&](size_t begin, size_t end, unsigned int) {
+					for (auto i = begin; i < end; ++i)
+						index.erase(expired_tweets[i]);
+				});
+				window.releaseExpired();
+			}
+			else if (type == SEAL)
+			{
+				const auto cutoff = reader.get<uint32_t>();
+				if (morton)
+					index.relocate(window.seal(cutoff, vector_size));
+			}
+		}
+	}
+
+	// forks the workers and keeps them in step with the coordinator's window
+	class Coordinator
+	{
+		const CellGrid &grid;
+		unsigned int columns, rows, vector_size;
+		vector<unique_ptr<Channel>> shards;
+		vector<pid_t> workers;
+		unordered_map<unsigned long long, Tweet*> tweets_by_sequence; // what the workers' replies refer to
+
+		void put(Channel &shard, const Tweet* tweet, bool owned);
+		// sends tweets to the tiles that need them; owned lists, per shard, the positions of the tweets it searches for
+		void distribute(const vector<Tweet*> &tweets, MessageType type, vector<vector<size_t>> &owned);
+		void send(Channel &shard, MessageType type);
+		void receive(Channel &shard, string &message);
+
+	public:
+		// every worker calls serve with its end of the socket pair in a child process, which exits once it returns;
+		// workers are forked before anything else, so they start with no threads and no connections of their own
+		Coordinator(const CellGrid &grid, unsigned int columns, unsigned int rows, unsigned int vector_size,
+			function<void(int socket, unsigned int tile)> serve);
+		~Coordinator();
+		void setCores(const vector<Tweet*> &cores);
+		void insert(const vector<Tweet*> &tweets);
+		// finds the neighbors within epsilon of every new tweet among the tweets before it; discarded tweets are null
+		SearchCounts search(const vector<Tweet*> &new_tweets, vector<vector<Neighbor>> &neighbors, unsigned int candidate_cap = 0);
+		void expire(unsigned int cutoff, const vector<Tweet*> &expired_tweets);
+		void seal(unsigned int cutoff, const unordered_map<Tweet*, Tweet*> &moved);
+	};
+
+	Coordinator::Coordinator(const CellGrid &grid, unsigned int columns, unsigned int rows, unsigned int vector_size,
+		function<void(int socket, unsigned int tile)> serve)
+		: grid(grid), columns(columns), rows(rows), vector_size(vector_size)
+	{
+		// nothing buffered is written twice by the children
+		cout.flush();
+		cerr.flush();
+
+		for (auto tile = 0u; tile < columns * rows; ++tile)
+		{
+			int sockets[2];
+			if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sockets) < 0)
+			{
+				cerr << "could not create a socket pair for shard " << tile << ": " << strerror(errno) << endl;
+				exit(EXIT_FAILURE);
+			}
+
+			const pid_t pid = fork();
+			if (pid < 0)
+			{
+				cerr << "could not fork shard " << tile << ": " << strerror(errno) << endl;
+				exit(EXIT_FAILURE);
+			}
+			if (!pid)
+			{
+				close(sockets[0]);
+				for (const auto &shard : shards)
+					close(shard->getSocket());
+				serve(sockets[1], tile);
+				_exit(EXIT_SUCCESS);
+			}
+
+			close(sockets[1]);
+			shards.emplace_back(new Channel(sockets[0]));
+			workers.push_back(pid);
+		}
+	}
+
+	Coordinator::~Coordinator()
+	{
+		// workers exit once their sockets close
+		shards.clear();
+		for (const auto &worker : workers)
+			waitpid(worker, nullptr, 0);
+	}
+
+	void Coordinator::put(Channel &shard, const Tweet* tweet, bool owned)
+	{
+		shard.put((uint64_t)tweet->sequence);
+		shard.put((uint32_t)tweet->time);
+		shard.put((uint32_t)tweet->x);
+		shard.put((uint32_t)tweet->y);
+		shard.put((uint8_t)owned);
+		shard.put((uint32_t)tweet->words.size());
+		shard.put(tweet->words.data(), tweet->words.size() * sizeof(uint32_t));
+		shard.put(tweet->getFeatures(), vector_size * sizeof(double));
+	}
+
+	void Coordinator::send(Channel &shard, MessageType type)
+	{
+		if (!shard.send(type))
+		{
+			cerr << "lost a shard worker" << endl;
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	void Coordinator::receive(Channel &shard, string &message)
+	{
+		MessageType type;
+		if (!shard.receive(type, message) || type != RESULT)
+		{
+			cerr << "lost a shard worker" << endl;
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	void Coordinator::distribute(const vector<Tweet*> &tweets, MessageType type, vector<vector<size_t>> &owned)
+	{
+		vector<vector<pair<const Tweet*, bool>>> sent(shards.size());
+		for (auto i = 0u; i < tweets.size(); ++i)
+		{
+			// tweets outside the box are never indexed, as in a single process
+			const auto &tweet = tweets[i];
+			if (!tweet || !grid.contains(tweet))
+				continue;
+			tweets_by_sequence[tweet->sequence] = tweet;
+
+			const auto owner = grid.getTile(tweet, columns, rows);
+			owned[owner].push_back(i);
+			grid.forRegionTiles(tweet, columns, rows, [&](unsigned int tile) {
+				sent[tile].emplace_back(tweet, tile == owner);
+			});
+		}
+
+		for (auto i = 0u; i < shards.size(); ++i)
+		{
+			shards[i]->put((uint32_t)sent[i].size());
+			for (const auto &tweet : sent[i])
+				put(*shards[i], tweet.first, tweet.second);
+			send(*shards[i], type);
+		}
+	}
+
+	void Coordinator::setCores(const vector<Tweet*> &cores)
+	{
+		for (const auto &shard : shards)
+		{
+			shard->put((uint32_t)cores.size());
+			for (const auto &core : cores)
+			{
+				tweets_by_sequence[core->sequence] = core;
+				shard->put((uint64_t)core->sequence);
+				shard->put(core->getFeatures(), vector_size * sizeof(double));
+			}
+			send(*shard, CORES);
+		}
+	}
+
+	void Coordinator::insert(const vector<Tweet*> &tweets)
+	{
+		vector<vector<size_t>> owned(shards.size());
+		distribute(tweets, INSERT, owned);
+	}
+
+	SearchCounts Coordinator::search(const vector<Tweet*> &new_tweets, vector<vector<Neighbor>> &neighbors, unsigned int candidate_cap)
+	{
+		// every worker gets its whole batch before any reply is read, so the tiles are searched side by side
+		for (const auto &shard : shards)
+			shard->put((uint32_t)candidate_cap);
+		vector<vector<size_t>> owned(shards.size());
+		distribute(new_tweets, SEARCH, owned);
+		neighbors.assign(new_tweets.size(), {});
+
+		SearchCounts counts;
+		string message;
+		for (auto i = 0u; i < shards.size(); ++i)
+		{
+			receive(*shards[i], message);
+			Reader reader(message);
+			counts.examined += reader.get<uint64_t>();
+			counts.capped += reader.get<uint64_t>();
+			counts.screened += reader.get<uint64_t>();
+			counts.computed += reader.get<uint64_t>();
+			for (const auto &position : owned[i])
+			{
+				auto &tweet_neighbors = neighbors[position];
+				tweet_neighbors.resize(reader.get<uint32_t>());
+				for (auto &neighbor : tweet_neighbors)
+				{
+					neighbor.tweet = tweets_by_sequence.at(reader.get<uint64_t>());
+					neighbor.distance = reader.get<float>();
+				}
+			}
+		}
+		return counts;
+	}
+
+	void Coordinator::expire(unsigned int cutoff, const vector<Tweet*> &expired_tweets)
+	{
+		for (const auto &tweet : expired_tweets)
+			tweets_by_sequence.erase(tweet->sequence);
+		for (const auto &shard : shards)
+		{
+			shard->put((uint32_t)cutoff);
+			send(*shard, EXPIRE);
+		}
+	}
+
+	void Coordinator::seal(unsigned int cutoff, const unordered_map<Tweet*, Tweet*> &moved)
+	{
+		for (const auto &tweet : moved)
+			tweets_by_sequence[tweet.second->sequence] = tweet.second;
+		for (const auto &shard : shards)
+		{
+			shard->put((uint32_t)cutoff);
+			send(*shard, SEAL);
+		}
+	}
+}
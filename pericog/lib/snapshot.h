@@ -0,0 +1,276 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <unordered_map>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "window.h"
+#include "tweet.h"
+
+using namespace std;
+
+// a checkpoint of the clustering window: every tweet with its vector, neighbor list, distances and the events it was
+// written under, laid out as fixed-size sections so a restart maps the file and walks it instead of parsing anything
+//   Header
+//   Record[tweet_count]                   cluster cores first, then the window's tweets
+//   double[tweet_count * vector_size]     feature vectors, in record order
+//   uint64[tweet_count * variant_count]   event ids under each of [variants], in record order
+//   Neighbor[neighbor_count]              neighbor lists, as indices into the records
+//   char[text_bytes]                      tweet texts, each followed by its user
+// everything is in native byte order, a snapshot is only meant to be read back on the machine that wrote it; only the
+// distances of [optics] are kept, those of [variants] follow from the neighbor lists again after a restore, so a
+// snapshot is only taken back under the same [optics] parameters
+namespace TMSnapshot
+{
+	const uint32_t VERSION = 4, BYTE_ORDER_MARK = 0x01020304;
+
+	struct Header
+	{
+		char magic[8];
+		uint32_t version, byte_order;
+		uint32_t vector_size, last_runtime;
+		uint32_t variant_count, minimum_points;
+		uint64_t tweet_sequence;
+		double epsilon; // how far the neighbor lists reach
+		double optics_epsilon; // [optics] epsilon, which with minimum_points gave the distances kept
+		uint64_t core_count, tweet_count, neighbor_count, text_bytes;
+	};
+
+	struct Record
+	{
+		uint64_t sequence, event;
+		double lat, lon, core_distance, smallest_reachability_distance;
+		uint64_t text_offset, neighbor_offset;
+		uint32_t time, text_length, user_length, neighbor_count;
+		uint32_t exact, padding;
+	};
+
+	struct Neighbor
+	{
+		uint32_t index;
+		float distance;
+	};
+
+	struct State
+	{
+		unsigned int last_runtime;
+		unsigned long long tweet_sequence;
+		double epsilon;
+		double optics_epsilon;
+		unsigned int minimum_points;
+	};
+
+	size_t getSize(const Header &header)
+	{
+		return sizeof(Header)
+			+ header.tweet_count * (sizeof(Record) + header.vector_size * sizeof(double) + header.variant_count * sizeof(uint64_t))
+			+ header.neighbor_count * sizeof(Neighbor)
+			+ header.text_bytes;
+	}
+
+	// writes next to path and renames over it, so a crash mid-write leaves the previous snapshot intact
+	bool save(const string &path, const Window &window, const vector<Tweet*> &cores, unsigned int vector_size, const State &state)
+	{
+		vector<const Tweet*> tweets(cores.begin(), cores.end());
+		for (const auto &slice : window.getSlices())
+			tweets.insert(tweets.end(), slice.second->tweets.begin(), slice.second->tweets.end());
+
+		unordered_map<const Tweet*, uint32_t> indices;
+		for (auto i = 0u; i < tweets.size(); ++i)
+			indices[tweets[i]] = i;
+
+		Header header;
+		memset(&header, 0, sizeof(header));
+		memcpy(header.magic, "TMSNAP", 6);
+		header.version = VERSION;
+		header.byte_order = BYTE_ORDER_MARK;
+		header.vector_size = vector_size;
+		header.last_runtime = state.last_runtime;
+		header.variant_count = Tweet::variant_count;
+		header.tweet_sequence = state.tweet_sequence;
+		header.epsilon = state.epsilon;
+		header.optics_epsilon = state.optics_epsilon;
+		header.minimum_points = state.minimum_points;
+		header.core_count = cores.size();
+		header.tweet_count = tweets.size();
+
+		vector<Record> records(tweets.size());
+		for (auto i = 0u; i < tweets.size(); ++i)
+		{
+			const auto &tweet = *tweets[i];
+			auto &record = records[i];
+			memset(&record, 0, sizeof(record));
+			record.sequence = tweet.sequence;
+			record.event = tweet.event;
+			record.lat = tweet.lat;
+			record.lon = tweet.lon;
+			record.core_distance = tweet.core_distance;
+			record.smallest_reachability_distance = tweet.smallest_reachability_distance;
+			record.time = tweet.time;
+			record.exact = tweet.exact;
+			record.text_offset = header.text_bytes;
+			record.text_length = tweet.text.size();
+			record.user_length = tweet.user.size();
+			record.neighbor_offset = header.neighbor_count;
+			record.neighbor_count = tweet.optics_neighbors.size();
+			header.text_bytes += tweet.text.size() + tweet.user.size();
+			header.neighbor_count += tweet.optics_neighbors.size();
+		}
+
+		const string temporary_path = path + ".tmp";
+		ofstream file(temporary_path, ios::binary | ios::trunc);
+		file.write((const char*)&header, sizeof(header));
+		file.write((const char*)records.data(), records.size() * sizeof(Record));
+		for (const auto &tweet : tweets)
+			file.write((const char*)tweet->getFeatures(), vector_size * sizeof(double));
+		for (const auto &tweet : tweets)
+		{
+			for (const auto &clustering : tweet->variants)
+			{
+				const uint64_t event = clustering.event;
+				file.write((const char*)&event, sizeof(event));
+			}
+		}
+		for (const auto &tweet : tweets)
+		{
+			for (const auto &neighbor : tweet->optics_neighbors)
+			{
+				const Neighbor entry{indices.at(neighbor.tweet), neighbor.distance};
+				file.write((const char*)&entry, sizeof(entry));
+			}
+		}
+		for (const auto &tweet : tweets)
+		{
+			file.write(tweet->text.data(), tweet->text.size());
+			file.write(tweet->user.data(), tweet->user.size());
+		}
+		file.close();
+
+		if (!file || rename(temporary_path.c_str(), path.c_str()))
+		{
+			cerr << "could not write snapshot " << path << endl;
+			unlink(temporary_path.c_str());
+			return false;
+		}
+		return true;
+	}
+
+	// restores the window and the cores' neighbor lists and distances; the restored tweets are returned so the caller
+	// can rebuild what is derived from them (words, cells, the neighbor index); nothing is touched if the snapshot
+	// is missing, damaged, or was taken with other cores, another vector size, other [variants], other [optics] parameters
+	// or shorter neighbor lists; state.epsilon is the reach the neighbor lists need, longer ones are cut back to it
+	bool load(const string &path, Window &window, const vector<Tweet*> &cores, unsigned int vector_size, State &state, vector<Tweet*> &restored)
+	{
+		const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+		if (fd < 0)
+			return false;
+
+		struct stat status;
+		if (fstat(fd, &status) < 0 || (size_t)status.st_size < sizeof(Header))
+		{
+			close(fd);
+			return false;
+		}
+		const size_t size = status.st_size;
+		void* mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		close(fd);
+		if (mapping == MAP_FAILED)
+			return false;
+
+		const char* data = (const char*)mapping;
+		auto reject = [&](const string &reason) {
+			cerr << "ignoring snapshot " << path << ": " << reason << endl;
+			munmap(mapping, size);
+			return false;
+		};
+
+		Header header;
+		memcpy(&header, data, sizeof(header));
+		if (memcmp(header.magic, "TMSNAP", 6) || header.version != VERSION || header.byte_order != BYTE_ORDER_MARK)
+			return reject("not a snapshot of this version");
+		if (header.vector_size != vector_size || header.core_count != cores.size() || header.variant_count != Tweet::variant_count
+		|| header.epsilon < state.epsilon || header.optics_epsilon != state.optics_epsilon
+		|| header.minimum_points != state.minimum_points)
+			return reject("does not match this configuration");
+		if (header.core_count > header.tweet_count || header.tweet_count > size || header.neighbor_count > size
+		|| header.text_bytes > size || getSize(header) != size)
+			return reject("damaged");
+
+		const auto records = (const Record*)(data + sizeof(Header));
+		const auto vectors = (const double*)(records + header.tweet_count);
+		const auto events = (const uint64_t*)(vectors + header.tweet_count * vector_size);
+		const auto neighbors = (const Neighbor*)(events + header.tweet_count * header.variant_count);
+		const auto texts = (const char*)(neighbors + header.neighbor_count);
+
+		for (auto i = 0u; i < header.core_count; ++i)
+		{
+			if (memcmp(vectors + i * vector_size, cores[i]->getFeatures(), vector_size * sizeof(double)))
+				return reject("cluster cores changed");
+		}
+		for (auto i = 0u; i < header.tweet_count; ++i)
+		{
+			const auto &record = records[i];
+			if (record.text_offset > header.text_bytes || record.text_length > header.text_bytes - record.text_offset
+			|| record.user_length > header.text_bytes - record.text_offset - record.text_length
+			|| record.neighbor_offset > header.neighbor_count || record.neighbor_count > header.neighbor_count - record.neighbor_offset)
+				return reject("damaged");
+			for (auto j = 0u; j < record.neighbor_count; ++j)
+			{
+				if (neighbors[record.neighbor_offset + j].index >= header.tweet_count)
+					return reject("damaged");
+			}
+		}
+
+		vector<Tweet*> tweets(cores.begin(), cores.end());
+		for (auto i = header.core_count; i < header.tweet_count; ++i)
+		{
+			const auto &record = records[i];
+			const double* vector_begin = vectors + i * vector_size;
+			tweets.push_back(window.create(record.time, record.lat, record.lon,
+				string(texts + record.text_offset, record.text_length),
+				vector<double>(vector_begin, vector_begin + vector_size)));
+		}
+
+		// distances are stored as floats, and rounding keeps every distance within epsilon within the rounded epsilon
+		const float within = state.epsilon;
+		for (auto i = 0u; i < header.tweet_count; ++i)
+		{
+			const auto &record = records[i];
+			auto &tweet = *tweets[i];
+			tweet.sequence = record.sequence;
+			tweet.event = record.event;
+			for (auto v = 0u; v < header.variant_count; ++v)
+				tweet.variants[v].event = events[i * header.variant_count + v];
+			tweet.user.assign(texts + record.text_offset + record.text_length, record.user_length);
+			tweet.exact = record.exact;
+			tweet.core_distance = record.core_distance;
+			tweet.smallest_reachability_distance = record.smallest_reachability_distance;
+			tweet.optics_neighbors.clear();
+			tweet.optics_neighbors.reserve(record.neighbor_count);
+			for (auto j = 0u; j < record.neighbor_count; ++j)
+			{
+				const auto &neighbor = neighbors[record.neighbor_offset + j];
+				if (neighbor.distance <= within)
+					tweet.optics_neighbors.push_back(::Neighbor{tweets[neighbor.index], neighbor.distance});
+			}
+		}
+
+		restored.assign(tweets.begin() + header.core_count, tweets.end());
+		for (const auto &tweet : restored)
+			window.insert(tweet);
+
+		state.last_runtime = header.last_runtime;
+		state.tweet_sequence = header.tweet_sequence;
+		munmap(mapping, size);
+		return true;
+	}
+}
@@ -0,0 +1,150 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <atomic>
+#include <memory>
+#include <iostream>
+#include <stdexcept>
+#include <functional>
+
+#include "mysql_connection.h"
+
+#include <cppconn/exception.h>
+#include <cppconn/resultset.h>
+#include <cppconn/statement.h>
+
+#include "ingest.h"
+
+using namespace std;
+
+// reads tweet_vectors ahead of the periods, on a connection and a thread of its own, so rows are fetched and their
+// vectors parsed while the main thread is still busy with the period before; only as many rows as the queue has room
+// for are read and marked taken, the rest wait in the table, and rows still in hand when the poller stops are put back
+class TablePoller : public IngestQueue
+{
+public:
+	typedef function<vector<double>(const string &vector)> VectorParser;
+
+private:
+	sql::Connection* connection;
+	VectorParser parse_vector;
+	atomic<bool> stopping;
+	thread poller;
+
+	void loop();
+	// queues as many rows not taken yet as there is room for, and returns how many there were
+	size_t poll();
+
+public:
+	TablePoller(sql::Connection* connection, VectorParser parse_vector, size_t capacity);
+	~TablePoller();
+};
+
+TablePoller::TablePoller(sql::Connection* connection, VectorParser parse_vector, size_t capacity)
+	: IngestQueue(capacity), connection(connection), parse_vector(parse_vector), stopping(false)
+{
+	poller = thread(&TablePoller::loop, this);
+}
+
+TablePoller::~TablePoller()
+{
+	// the poller never waits on the queue, and puts back the rows in hand once it finds it closed
+	stopping = true;
+	queue.close();
+	poller.join();
+}
+
+void TablePoller::loop()
+{
+	while (!stopping)
+	{
+		size_t polled = 0;
+		try
+		{
+			polled = poll();
+		}
+		catch (sql::SQLException &e)
+		{
+			cerr << "polling tweet_vectors failed: " << e.what() << endl;
+			this_thread::sleep_for(chrono::seconds(1));
+		}
+
+		if (!polled)
+			this_thread::sleep_for(chrono::milliseconds(5));
+	}
+}
+
+size_t TablePoller::poll()
+{
+	// nothing else pushes, so every row read fits in the queue without waiting
+	const auto room = queue.available();
+	if (!room)
+		return 0;
+
+	unique_ptr<sql::Statement> statement(connection->createStatement());
+	unique_ptr<sql::ResultSet> db_tweets(statement->executeQuery(
+			"SELECT *, UNIX_TIMESTAMP(time) AS unix_time FROM tweet_vectors WHERE status = 0 ORDER BY time LIMIT " + to_string(room)
+		));
+
+	struct Row
+	{
+		string id, time, lat, lon, text, user, vector;
+	};
+	vector<Row> rows;
+	string updated_tweet_ids = "";
+	while (db_tweets->next())
+	{
+		rows.push_back(Row{
+				db_tweets->getString("id"),
+				db_tweets->getString("unix_time"),
+				db_tweets->getString("lat"),
+				db_tweets->getString("lon"),
+				db_tweets->getString("text"),
+				db_tweets->getString("user"),
+				db_tweets->getString("vector")
+			});
+
+		updated_tweet_ids += rows.back().id + ",";
+	}
+	if (rows.empty())
+		return 0;
+
+	updated_tweet_ids.pop_back(); // take the extra comma out
+	statement->execute("UPDATE tweet_vectors SET status = 1 WHERE tweet_id IN (" +updated_tweet_ids+ ")");
+
+	for (auto i = 0u; i < rows.size(); ++i)
+	{
+		const auto &row = rows[i];
+		Record record;
+		try
+		{
+			record.id = stoull(row.id);
+			record.time = stoi(row.time);
+			record.lat = stod(row.lat);
+			record.lon = stod(row.lon);
+			record.feature_vector = parse_vector(row.vector);
+		}
+		catch (logic_error &)
+		{
+			rejected++;
+			continue;
+		}
+		record.text = row.text;
+		record.user = row.user;
+
+		if (!queue.push(move(record)))
+		{
+			// stopping; the rows not queued are left for the next run
+			string returned_tweet_ids = "";
+			for (; i < rows.size(); ++i)
+				returned_tweet_ids += rows[i].id + ",";
+			returned_tweet_ids.pop_back();
+			statement->execute("UPDATE tweet_vectors SET status = 0 WHERE tweet_id IN (" +returned_tweet_ids+ ")");
+			break;
+		}
+	}
+	return rows.size();
+}
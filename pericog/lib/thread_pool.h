@@ -0,0 +1,181 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <condition_variable>
+#include <algorithm>
+
+// a fixed set of workers kept alive for the whole run; the thread calling parallelFor is worker 0
+class ThreadPool
+{
+public:
+	typedef std::function<void(size_t begin, size_t end, unsigned int worker)> Task;
+
+private:
+	struct Queue
+	{
+		std::mutex lock;
+		std::deque<std::pair<size_t, size_t>> ranges;
+	};
+
+	std::vector<std::thread> threads;
+	std::vector<std::unique_ptr<Queue>> queues;
+
+	std::mutex job_lock;
+	std::condition_variable job_ready, job_done;
+	const Task* job = nullptr;
+	unsigned long generation = 0;
+	unsigned int active = 0;
+	bool stopping = false;
+	std::atomic<size_t> remaining;
+
+	void loop(unsigned int worker);
+	void work(const Task &task, unsigned int worker);
+	bool takeRange(unsigned int worker, std::pair<size_t, size_t> &range);
+
+public:
+	ThreadPool(unsigned int size);
+	~ThreadPool();
+	unsigned int size() const;
+
+	// calls task on chunks of [0, count) until all are done; every worker starts on its own contiguous
+	// run of chunks and steals from the back of the others' runs once it finishes
+	void parallelFor(size_t count, size_t chunk, const Task &task);
+};
+
+ThreadPool::ThreadPool(unsigned int size)
+	: remaining(0)
+{
+	if (!size)
+		size = 1;
+
+	for (auto i = 0u; i < size; ++i)
+		queues.emplace_back(new Queue());
+
+	for (auto i = 1u; i < size; ++i)
+		threads.emplace_back(&ThreadPool::loop, this, i);
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(job_lock);
+		stopping = true;
+	}
+	job_ready.notify_all();
+
+	for (auto &thread : threads)
+		thread.join();
+}
+
+unsigned int ThreadPool::size() const
+{
+	return queues.size();
+}
+
+void ThreadPool::parallelFor(size_t count, size_t chunk, const Task &task)
+{
+	if (!count)
+		return;
+
+	chunk = std::max<size_t>(chunk, 1);
+	const size_t chunks = (count + chunk - 1) / chunk;
+	const size_t chunks_per_worker = (chunks + size() - 1) / size();
+	for (auto worker = 0u; worker < size(); ++worker)
+	{
+		std::lock_guard<std::mutex> lock(queues[worker]->lock);
+		for (size_t i = worker * chunks_per_worker; i < std::min(chunks, (worker + 1) * chunks_per_worker); ++i)
+			queues[worker]->ranges.emplace_back(i * chunk, std::min(count, (i + 1) * chunk));
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(job_lock);
+		remaining = chunks;
+		job = &task;
+		++generation;
+	}
+	job_ready.notify_all();
+
+	work(task, 0);
+
+	// workers that picked the job up must be finished with it before task goes out of scope
+	std::unique_lock<std::mutex> lock(job_lock);
+	job_done.wait(lock, [this]() { return !remaining && !active; });
+	job = nullptr;
+}
+
+void ThreadPool::loop(unsigned int worker)
+{
+	unsigned long seen = 0;
+	while (true)
+	{
+		const Task* task;
+		{
+			std::unique_lock<std::mutex> lock(job_lock);
+			job_ready.wait(lock, [&]() { return stopping || generation != seen; });
+			if (stopping)
+				return;
+
+			seen = generation;
+			task = job;
+			if (!task)
+				continue;
+			++active;
+		}
+
+		work(*task, worker);
+
+		{
+			std::lock_guard<std::mutex> lock(job_lock);
+			--active;
+		}
+		job_done.notify_all();
+	}
+}
+
+void ThreadPool::work(const Task &task, unsigned int worker)
+{
+	std::pair<size_t, size_t> range;
+	while (takeRange(worker, range))
+	{
+		task(range.first, range.second, worker);
+		if (--remaining == 0)
+		{
+			std::lock_guard<std::mutex> lock(job_lock);
+			job_done.notify_all();
+		}
+	}
+}
+
+bool ThreadPool::takeRange(unsigned int worker, std::pair<size_t, size_t> &range)
+{
+	{
+		auto &own = *queues[worker];
+		std::lock_guard<std::mutex> lock(own.lock);
+		if (!own.ranges.empty())
+		{
+			range = own.ranges.front();
+			own.ranges.pop_front();
+			return true;
+		}
+	}
+
+	for (auto i = 1u; i < size(); ++i)
+	{
+		auto &victim = *queues[(worker + i) % size()];
+		std::lock_guard<std::mutex> lock(victim.lock);
+		if (!victim.ranges.empty())
+		{
+			range = victim.ranges.back();
+			victim.ranges.pop_back();
+			return true;
+		}
+	}
+
+	return false;
+}
@@ -5,10 +5,14 @@
 #include <iostream>
 #include <thread>
 
+#include "metrics.h"
+
+// times the stages of a period on the monotonic clock; every stage is recorded in metrics, if it is set,
+// and printed only when verbose
 class TimeKeeper {
 
-	std::chrono::time_point<std::chrono::system_clock, std::chrono::system_clock::duration> programStartTime;
-	std::chrono::duration<std::chrono::system_clock::rep, std::chrono::system_clock::period> programDuration;
+	std::chrono::steady_clock::time_point programStartTime;
+	std::chrono::steady_clock::duration programDuration;
 	std::string title;
 	bool running = false;
 
@@ -16,6 +20,8 @@ class TimeKeeper {
 
 public:
 	static int levels;
+	static Metrics* metrics;
+	static bool verbose;
 
 	TimeKeeper();
 	~TimeKeeper();
@@ -42,20 +48,23 @@ void TimeKeeper::start(std::string s) {
 	}
 	running = true;
 	title = s;
-	programStartTime = std::chrono::system_clock::now();
+	programStartTime = std::chrono::steady_clock::now();
 }
 
 void TimeKeeper::stop() {
-	programDuration = std::chrono::system_clock::now() - programStartTime;
+	programDuration = std::chrono::steady_clock::now() - programStartTime;
 	if (running)
 	{
-		print();
+		if (metrics)
+			metrics->observe("pericog_stage_seconds", "Time spent in each stage of a period.", duration(), "stage=\"" + title + "\"");
+		if (verbose)
+			print();
 		running = false;
 	}
 }
 
 double TimeKeeper::duration() {
-	return std::chrono::duration_cast<std::chrono::milliseconds>(programDuration).count() / 1000.0;
+	return std::chrono::duration<double>(programDuration).count();
 }
 
 
@@ -69,4 +78,6 @@ void TimeKeeper::print() {
 void TimeKeeper::sleep() {
 	std::this_thread::sleep_for(std::chrono::seconds(10000));
 }
-int TimeKeeper::levels = 0;
\ No newline at end of file
+int TimeKeeper::levels = 0;
+Metrics* TimeKeeper::metrics = nullptr;
+bool TimeKeeper::verbose = true;
\ No newline at end of file
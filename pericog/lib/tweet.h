@@ -1,39 +1,250 @@
 #pragma once
 
 #include <string>
+#include <cstdint>
+#include <cmath>
+#include <cstdlib>
 #include <vector>
+#include <algorithm>
 #include <unordered_set>
 #include <unordered_map>
 
+#include "dictionary.h"
+#include "distance.h"
+#include "tokenizer.h"
+
 using namespace std;
 
+const int
+	MAX_DEGREES_LATITUDE = 90,
+	MAX_DEGREES_LONGITUDE = 180;
+
+struct Tweet;
+
+struct Neighbor
+{
+	Tweet* tweet;
+	float distance;
+};
+
+// what one of the parameter sets of [variants] derives for a tweet
+struct Clustering
+{
+	double core_distance = INFINITY, smallest_reachability_distance = INFINITY;
+	unsigned long long event = 0;
+};
+
 struct Tweet
 {
 	static Tweet* delimiter;
+	static unsigned int variant_count; // parameter sets besides [optics], every tweet keeps a Clustering for each
 
-	bool important = false;
-
-	bool require_update = true;
-	double core_distance, smallest_reachability_distance;
+	unsigned long long sequence = 0; // order of arrival, cluster cores come first
+	unsigned long long event = 0; // id of the event the tweet was last written under
+	bool require_update = false, expired = false;
+	uint32_t plot_index = UINT32_MAX; // where getClusters keeps the tweet while it runs
+	double core_distance = INFINITY, smallest_reachability_distance = INFINITY;
 
 	unsigned int time;
 	double lat, lon;
-	string text;
-	vector<double> feature_vector;
+	string text, user;
+	bool exact = false;
+	vector<double> feature_vector; // emptied once the tweet's slice is sealed
+	const double* packed_features = nullptr; // where the vector is kept once the tweet's slice is sealed
+	double norm;
+	// the unit vector rounded to int8, for ruling candidates out cheaply; empty unless quantized
+	vector<int8_t> quantized;
+	double quantized_scale = 0, quantized_error = 0;
 
 	unsigned int x, y;
-	string clean_text;
-	unordered_set<string> words;
-	multimap<double, Tweet*> optics_neighbors;
-	unordered_map<Tweet*, double> optics_distances;
-	unordered_map<string, double> regional_word_rates;
+	vector<uint32_t> words; // dictionary ids, sorted
+	vector<Neighbor> optics_neighbors; // only tweets within epsilon, sorted by distance
+	vector<Clustering> variants;
 
 	Tweet(int _time, double _lat, double _lon, string _text, vector<double> _feature_vector)
-		: time(_time), lat(_lat), lon(_lon), text(_text), feature_vector(_feature_vector)
+		: time(_time), lat(_lat), lon(_lon), text(_text), feature_vector(_feature_vector), norm(TMDistance::norm(feature_vector)),
+		variants(variant_count)
 	{}
 	Tweet(vector<double> _feature_vector = {})
-		: time(0), feature_vector(_feature_vector)
+		: time(0), feature_vector(_feature_vector), norm(TMDistance::norm(feature_vector)), variants(variant_count)
 	{}
-	void clean();
-	~Tweet();
+	// the results of a parameter set: 0 is [optics], whose results are the tweet's own fields, the rest are [variants]
+	double &coreDistance(unsigned int variant) { return variant ? variants[variant - 1].core_distance : core_distance; }
+	double coreDistance(unsigned int variant) const { return variant ? variants[variant - 1].core_distance : core_distance; }
+	double &smallestReachabilityDistance(unsigned int variant)
+	{
+		return variant ? variants[variant - 1].smallest_reachability_distance : smallest_reachability_distance;
+	}
+	double smallestReachabilityDistance(unsigned int variant) const
+	{
+		return variant ? variants[variant - 1].smallest_reachability_distance : smallest_reachability_distance;
+	}
+	unsigned long long &eventId(unsigned int variant) { return variant ? variants[variant - 1].event : event; }
+	const double* getFeatures() const
+	{
+		return packed_features ? packed_features : feature_vector.data();
+	}
+	// fills in words and the grid cell
+	void clean(Dictionary &dictionary, double cell_size);
+	void quantize(unsigned int vector_size);
+	void sortNeighbors();
 };
+
+void Tweet::clean(Dictionary &dictionary, double cell_size)
+{
+	TMTokenizer::tokenize(text, [&](const string &word) {
+		words.push_back(dictionary.intern(word));
+	});
+	sort(words.begin(), words.end());
+	words.erase(unique(words.begin(), words.end()), words.end());
+
+	x = floor((lon + MAX_DEGREES_LONGITUDE)/cell_size);
+	y = floor((lat + MAX_DEGREES_LATITUDE)/cell_size);
+}
+
+void Tweet::quantize(unsigned int vector_size)
+{
+	quantized.clear();
+	if (!(norm > 0))
+		return;
+
+	// the largest component maps to 127, so each component is off by at most half a step of quantized_scale
+	const double* features = getFeatures();
+	double largest = 0;
+	for (auto i = 0u; i < vector_size; ++i)
+		largest = max(largest, fabs(features[i] / norm));
+	quantized_scale = largest / 127;
+
+	double l1 = 0;
+	quantized.resize(vector_size);
+	for (auto i = 0u; i < vector_size; ++i)
+	{
+		quantized[i] = max(-127l, min(127l, lround(features[i] / norm / quantized_scale)));
+		l1 += abs(quantized[i]);
+	}
+	quantized_error = quantized_scale * l1 / 2;
+}
+
+void Tweet::sortNeighbors()
+{
+	// equal distances keep insertion order, like the multimap this replaced
+	stable_sort(optics_neighbors.begin(), optics_neighbors.end(),
+		[](const Neighbor &a, const Neighbor &b) { return a.distance < b.distance; });
+}
+
+// whether the distance between A and B could be epsilon or less, going by their quantized vectors alone;
+// the bound on the rounding error is a strict one, so a pair ruled out is always farther apart than epsilon
+inline bool mayBeWithin(const Tweet &A, const Tweet &B, double epsilon, int32_t dot, unsigned int vector_size)
+{
+	if (A.quantized.empty() || B.quantized.empty())
+		return true;
+
+	// each rounding error meets at most half the other vector's L1 norm, plus the errors meeting each other
+	const double scales = A.quantized_scale * B.quantized_scale;
+	const double similarity = scales * dot;
+	const double error = B.quantized_scale * A.quantized_error + A.quantized_scale * B.quantized_error + scales * vector_size / 4;
+	return 1 - similarity - error <= epsilon + 1e-9;
+}
+
+// the same, computing the dot product of their quantized vectors itself
+inline bool mayBeWithin(const Tweet &A, const Tweet &B, double epsilon, TMDistance::QuantizedDotProduct dotProduct, unsigned int vector_size)
+{
+	return A.quantized.empty() || B.quantized.empty()
+		|| mayBeWithin(A, B, epsilon, dotProduct(A.quantized.data(), B.quantized.data(), vector_size), vector_size);
+}
+
+// cosine distance; norms are cached on the tweets, so only the dot product is computed per pair
+inline double getDistance(const Tweet &A, const Tweet &B, TMDistance::DotProduct dotProduct, unsigned int vector_size)
+{
+	return 1 - (dotProduct(A.getFeatures(), B.getFeatures(), vector_size) / (A.norm * B.norm));
+}
+
+// the distances of a run of tweets to every cluster core, from dot products computed a block at a time rather than a
+// pair at a time; cores come first in sequence, so a candidate's sequence tells whether it is a core and which one
+//
+// with the exact block kernel the distances are read from the block; with the quantized one, the block holds the int8
+// dot products the screen decides on, and only the pairs it keeps are measured by getDistance; with neither there are
+// no cores to look up, and every candidate is left to the per-pair path
+class CoreDistances
+{
+	TMDistance::DotProduct dotProduct;
+	TMDistance::DotProductBlock dotProductBlock;
+	TMDistance::QuantizedDotProductBlock quantizedDotProductBlock;
+	unsigned int vector_size;
+	unsigned long long first_sequence;
+	size_t core_count = 0;
+	vector<const double*> core_features, tweet_features;
+	vector<const int8_t*> core_quantized, tweet_quantized;
+	vector<int8_t> zeros; // stands in for vectors that were not quantized, which the screen always keeps
+	vector<double> dots;
+	vector<int32_t> quantized_dots;
+
+public:
+	CoreDistances(const vector<Tweet*> &cores, TMDistance::DotProduct dotProduct, TMDistance::DotProductBlock dotProductBlock,
+		TMDistance::QuantizedDotProductBlock quantizedDotProductBlock, unsigned int vector_size);
+	// one row per tweet, nulls included
+	void compute(Tweet* const *tweets, size_t count);
+	bool isCore(const Tweet &candidate) const
+	{
+		return candidate.sequence - first_sequence < core_count;
+	}
+	// what mayBeWithin decides for the core and the tweet in row
+	bool mayBeWithin(const Tweet &core, size_t row, const Tweet &tweet, double epsilon) const
+	{
+		return !quantizedDotProductBlock
+			|| ::mayBeWithin(core, tweet, epsilon, quantized_dots[row * core_count + (core.sequence - first_sequence)], vector_size);
+	}
+	// what getDistance gives for the core and the tweet in row
+	double getDistance(const Tweet &core, size_t row, const Tweet &tweet) const
+	{
+		if (!dotProductBlock)
+			return ::getDistance(core, tweet, dotProduct, vector_size);
+		return 1 - (dots[row * core_count + (core.sequence - first_sequence)] / (core.norm * tweet.norm));
+	}
+};
+
+CoreDistances::CoreDistances(const vector<Tweet*> &cores, TMDistance::DotProduct dotProduct,
+	TMDistance::DotProductBlock dotProductBlock, TMDistance::QuantizedDotProductBlock quantizedDotProductBlock,
+	unsigned int vector_size)
+	: dotProduct(dotProduct), dotProductBlock(dotProductBlock), quantizedDotProductBlock(quantizedDotProductBlock),
+	vector_size(vector_size), first_sequence(cores.empty() ? 0 : cores[0]->sequence)
+{
+	if (!dotProductBlock && !quantizedDotProductBlock)
+		return;
+	core_count = cores.size();
+	if (dotProductBlock)
+	{
+		for (const auto &core : cores)
+			core_features.push_back(core->getFeatures());
+	}
+	if (quantizedDotProductBlock)
+	{
+		zeros.resize(vector_size);
+		for (const auto &core : cores)
+			core_quantized.push_back(core->quantized.empty() ? zeros.data() : core->quantized.data());
+	}
+}
+
+void CoreDistances::compute(Tweet* const *tweets, size_t count)
+{
+	if (!core_count)
+		return;
+
+	// null rows are computed against a core and never read
+	if (dotProductBlock)
+	{
+		tweet_features.clear();
+		for (auto i = 0u; i < count; ++i)
+			tweet_features.push_back(tweets[i] ? tweets[i]->getFeatures() : core_features[0]);
+		dots.resize(count * core_count);
+		dotProductBlock(tweet_features.data(), count, core_features.data(), core_count, vector_size, dots.data());
+	}
+	if (quantizedDotProductBlock)
+	{
+		tweet_quantized.clear();
+		for (auto i = 0u; i < count; ++i)
+			tweet_quantized.push_back(tweets[i] && !tweets[i]->quantized.empty() ? tweets[i]->quantized.data() : zeros.data());
+		quantized_dots.resize(count * core_count);
+		quantizedDotProductBlock(tweet_quantized.data(), count, core_quantized.data(), core_count, vector_size, quantized_dots.data());
+	}
+}
@@ -0,0 +1,224 @@
+#pragma once
+
+#include <map>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <mutex>
+#include <memory>
+#include <string>
+#include <vector>
+#include <unordered_set>
+#include <unordered_map>
+
+#include "arena.h"
+#include "tweet.h"
+
+using namespace std;
+
+// the tweets recent enough to be clustered, grouped into one slice per period so a whole period ages out at once;
+// each slice allocates its tweets from its own arena, which is released in one piece when the slice expires
+class Window
+{
+public:
+	struct Slice
+	{
+		unsigned int start;
+		bool sealed = false;
+		vector<Tweet*> tweets;
+		Arena arena;
+	};
+
+private:
+	unsigned int period;
+	size_t tweet_count = 0;
+	map<unsigned int, unique_ptr<Slice>> slices;
+	vector<unique_ptr<Slice>> expired_slices;
+	mutex lock; // guards slice creation and arena allocation, so tweets can be created from any thread
+
+	Slice &getSlice(unsigned int time);
+	static uint64_t getMortonCode(unsigned int x, unsigned int y);
+
+public:
+	Window(unsigned int period);
+	~Window();
+	Tweet* create(unsigned int time, double lat, double lon, const string &text, vector<double> &&feature_vector);
+	// for tweets that were created but never inserted
+	void discard(Tweet* tweet);
+	void insert(Tweet* tweet);
+	// removes every slice whose tweets are all at or before cutoff and returns their tweets;
+	// they stay allocated until releaseExpired, so references to them can still be cleaned up
+	vector<Tweet*> expire(unsigned int cutoff);
+	void releaseExpired();
+	// moves the tweets of every slice whose tweets are all at or before cutoff into Morton order of their cells, each
+	// record followed by its vector, so the tweets of a region lie close together and a scan of candidates sorted by
+	// address reads forward through memory; neighbor lists are repointed, anything else holding the tweets has to be
+	// repointed by the caller from the returned old and new addresses; tweets arriving late for a sealed slice are
+	// left where they are
+	unordered_map<Tweet*, Tweet*> seal(unsigned int cutoff, unsigned int vector_size);
+	size_t size() const;
+	const map<unsigned int, unique_ptr<Slice>> &getSlices() const;
+};
+
+Window::Window(unsigned int period)
+	: period(period ? period : 1)
+{}
+
+Window::~Window()
+{
+	for (auto &slice : slices)
+		expired_slices.push_back(move(slice.second));
+	releaseExpired();
+}
+
+Window::Slice &Window::getSlice(unsigned int time)
+{
+	const unsigned int start = time - time % period;
+	auto &slice = slices[start];
+	if (!slice)
+	{
+		slice.reset(new Slice());
+		slice->start = start;
+	}
+	return *slice;
+}
+
+Tweet* Window::create(unsigned int time, double lat, double lon, const string &text, vector<double> &&feature_vector)
+{
+	// only the allocation takes the lock, the tweet is built outside it so threads parsing tweets do not queue here
+	void* memory;
+	{
+		lock_guard<mutex> guard(lock);
+		memory = getSlice(time).arena.allocate(sizeof(Tweet), alignof(Tweet));
+	}
+	return new (memory) Tweet(time, lat, lon, text, move(feature_vector));
+}
+
+void Window::discard(Tweet* tweet)
+{
+	tweet->~Tweet();
+}
+
+void Window::insert(Tweet* tweet)
+{
+	lock_guard<mutex> guard(lock);
+	getSlice(tweet->time).tweets.push_back(tweet);
+	tweet_count++;
+}
+
+vector<Tweet*> Window::expire(unsigned int cutoff)
+{
+	vector<Tweet*> expired_tweets;
+	while (!slices.empty())
+	{
+		auto &slice = slices.begin()->second;
+		if (slice->start + period - 1 > cutoff)
+			break;
+
+		expired_tweets.insert(expired_tweets.end(), slice->tweets.begin(), slice->tweets.end());
+		tweet_count -= slice->tweets.size();
+		expired_slices.push_back(move(slice));
+		slices.erase(slices.begin());
+	}
+	return expired_tweets;
+}
+
+void Window::releaseExpired()
+{
+	for (auto &slice : expired_slices)
+	{
+		for (auto &tweet : slice->tweets)
+			tweet->~Tweet();
+	}
+	expired_slices.clear();
+}
+
+unordered_map<Tweet*, Tweet*> Window::seal(unsigned int cutoff, unsigned int vector_size)
+{
+	unordered_map<Tweet*, Tweet*> moved;
+	vector<Arena> retired;
+	for (auto &entry : slices)
+	{
+		auto &slice = *entry.second;
+		if (slice.start + period - 1 > cutoff)
+			break;
+		if (slice.sealed)
+			continue;
+
+		// equal cells keep the order of arrival, so the layout never depends on anything but the tweets
+		stable_sort(slice.tweets.begin(), slice.tweets.end(), [](const Tweet* a, const Tweet* b) {
+			return getMortonCode(a->x, a->y) < getMortonCode(b->x, b->y);
+		});
+
+		// every record is followed by its vector, in a fresh arena that replaces the slice's
+		const size_t bytes = vector_size * sizeof(double);
+		Arena packed;
+		for (auto &tweet : slice.tweets)
+		{
+			const double* features = tweet->getFeatures(); // moving the record keeps the vector's buffer
+			auto packed_tweet = packed.create<Tweet>(move(*tweet));
+			auto packed_features = (double*)packed.allocate(bytes, alignof(double));
+			memcpy(packed_features, features, bytes);
+			packed_tweet->packed_features = packed_features;
+			vector<double>().swap(packed_tweet->feature_vector);
+
+			tweet->~Tweet();
+			moved[tweet] = packed_tweet;
+			tweet = packed_tweet;
+		}
+		swap(slice.arena, packed);
+		// old addresses must not be handed out again while they still mean the tweets that moved
+		retired.push_back(move(packed));
+		slice.sealed = true;
+	}
+
+	// neighbor lists are symmetric, so every list that names a moved tweet belongs to a moved tweet or one of its neighbors
+	unordered_set<Tweet*> stayed;
+	for (const auto &tweet : moved)
+	{
+		for (auto &neighbor : tweet.second->optics_neighbors)
+		{
+			const auto found = moved.find(neighbor.tweet);
+			if (found != moved.end())
+				neighbor.tweet = found->second;
+			else
+				stayed.insert(neighbor.tweet);
+		}
+	}
+	for (const auto &tweet : stayed)
+	{
+		for (auto &neighbor : tweet->optics_neighbors)
+		{
+			const auto found = moved.find(neighbor.tweet);
+			if (found != moved.end())
+				neighbor.tweet = found->second;
+		}
+	}
+
+	return moved;
+}
+
+uint64_t Window::getMortonCode(unsigned int x, unsigned int y)
+{
+	// interleaves the bits of x and y, so cells close on the grid get close codes
+	auto spread = [](uint64_t value) {
+		value &= 0xffffffff;
+		value = (value | (value << 16)) & 0x0000ffff0000ffffull;
+		value = (value | (value << 8))  & 0x00ff00ff00ff00ffull;
+		value = (value | (value << 4))  & 0x0f0f0f0f0f0f0f0full;
+		value = (value | (value << 2))  & 0x3333333333333333ull;
+		value = (value | (value << 1))  & 0x5555555555555555ull;
+		return value;
+	};
+	return spread(x) | (spread(y) << 1);
+}
+
+size_t Window::size() const
+{
+	return tweet_count;
+}
+
+const map<unsigned int, unique_ptr<Window::Slice>> &Window::getSlices() const
+{
+	return slices;
+}
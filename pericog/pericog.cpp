@@ -1,96 +1,130 @@
 #include "pericog.h"
 
-const int
-	MAX_DEGREES_LATITUDE = 90,
-	MAX_DEGREES_LONGITUDE = 180;
-
-unsigned int last_runtime = 0, RECALL_SCOPE, PERIOD, MIN_PTS, MIN_TWEETS = 3, VECTOR_SIZE, THREAD_COUNT, BATCH_SIZE;
-double EPSILON, REACHABILITY_MAXIMUM, REACHABILITY_MINIMUM, MAX_SPACIAL_DISTANCE, CELL_SIZE;
-string ACTIVE_ZONE, TARGET_IP;
+unsigned long long tweet_sequence = 0;
+unsigned int last_runtime = 0, RECALL_SCOPE, PERIOD, MIN_PTS, MIN_TWEETS = 3, VECTOR_SIZE, THREAD_COUNT, BATCH_SIZE, LSH_TABLES, LSH_BITS, INGEST_CAPACITY, SNAPSHOT_INTERVAL, SHARD_COLUMNS, SHARD_ROWS, SHARD_THREADS, CANDIDATE_CAP, MAX_SKIPPED;
+double DEGRADE_LAG, RECOVER_LAG, EPSILON, NEIGHBOR_EPSILON, REACHABILITY_MAXIMUM, REACHABILITY_MINIMUM, MAX_SPACIAL_DISTANCE, CELL_SIZE, WEST, EAST, SOUTH, NORTH;
+string VARIANT_SECTIONS, REGION, WINDOW_LAYOUT, CLUSTER_EXTRACTION, PERIOD_EXECUTION, QUANTIZATION, ACTIVE_ZONE, TARGET_IP, INDEX, INGEST_SOURCE, INGEST_SOCKET, VECTOR_FORMAT, SNAPSHOT_PATH, METRICS_PATH, LOG_LEVEL;
 
 sql::Connection* local_connection, * tweets_connection;
 
-vector<Tweet*> cluster_cores;
-vector<vector<Cell>> Cell::cells;
-Tweet* Tweet::delimiter;
-
-void Tweet::clean()
+TMDistance::DotProduct dotProduct;
+TMDistance::QuantizedDotProduct quantizedDotProduct = nullptr; // null unless candidates are screened
+TMDistance::DotProductBlock dotProductBlock = nullptr; // null when candidates are screened
+TMDistance::QuantizedDotProductBlock quantizedDotProductBlock = nullptr; // null unless candidates are screened
+CellGrid* grid;
+NeighborIndex* neighbor_index;
+ThreadPool* pool;
+OpticsUpdater optics_updater;
+IngestQueue* ingest = nullptr; // null when tweets are polled from mysql within the period
+PipelineStage* writer = nullptr; // null when events are written within the period
+TMShards::Coordinator* shards = nullptr; // null when this process searches the whole box itself
+PeriodScheduler* scheduler;
+Dictionary dictionary;
+
+Metrics metrics;
+Metrics::Counter
+	&tweets_received      = metrics.counter("pericog_tweets_received_total",      "Tweets read from tweet_vectors or the ingest socket."),
+	&tweets_discarded     = metrics.counter("pericog_tweets_discarded_total",     "Tweets dropped for having no words left after cleaning, or for lying outside the grid."),
+	&tweets_expired       = metrics.counter("pericog_tweets_expired_total",       "Tweets that aged out of the window."),
+	&candidates_examined  = metrics.counter("pericog_candidates_examined_total",  "Possible neighbors the index returned for new tweets."),
+	&candidates_capped    = metrics.counter("pericog_candidates_capped_total",    "Possible neighbors left unexamined by the candidate cap of degraded periods."),
+	&distances_computed   = metrics.counter("pericog_distances_computed_total",   "Distances computed between new tweets and their candidates."),
+	&distances_screened   = metrics.counter("pericog_distances_screened_total",   "Candidates ruled out by their quantized vectors, without computing the distance."),
+	&neighbors_linked     = metrics.counter("pericog_neighbors_linked_total",     "Pairs of tweets found within epsilon of each other."),
+	&ingest_rejected      = metrics.counter("pericog_ingest_rejected_total",      "Records on the ingest socket or rows read from tweet_vectors that did not hold a valid tweet."),
+	&events_written       = metrics.counter("pericog_events_written_total",       "Events inserted or rewritten."),
+	&events_removed       = metrics.counter("pericog_events_removed_total",       "Events deleted because their cluster ended."),
+	&event_write_failures = metrics.counter("pericog_event_write_failures_total", "Periods whose event writes were rolled back."),
+	&periods_degraded     = metrics.counter("pericog_periods_degraded_total",     "Periods run degraded, because they started too long after they were due."),
+	&extractions_skipped  = metrics.counter("pericog_extractions_skipped_total",  "Degraded periods whose clusters were not extracted, because the next period was due already.");
+
+// a parameter set clustered over the shared window and neighbor lists into event tables of its own
+struct Variant
 {
-	static regex mentionsAndUrls("((\\B@)|(\\bhttps?:\\/\\/))[^\\s]+");
-	static regex nonWord("[^\\w]+");
-	string clean_text = regex_replace(text, mentionsAndUrls, string(" "));
-	clean_text = regex_replace(clean_text, nonWord, string(" "));
-	transform(clean_text.begin(), clean_text.end(), clean_text.begin(), ::tolower);
-	clean_text.erase(0, clean_text.find_first_not_of(" "));
-	clean_text.erase(clean_text.find_last_not_of(" ") + 1);
-	words = TMUtil::explode(clean_text);
-
-	x = floor((lon + MAX_DEGREES_LONGITUDE)/CELL_SIZE);
-	y = floor((lat + MAX_DEGREES_LATITUDE)/CELL_SIZE);
-}
+	string name;
+	OpticsParameters optics;
+	double reachability_minimum, reachability_maximum;
+	string events_table, event_tweets_table;
+	EventWriter* event_writer;
+};
+vector<Variant> variants; // [optics] first, then every section named in [variants]
+// one batch per variant; the writer commits the pending ones while the next period prepares the filling ones
+vector<EventWriter::Batch> filling_writes, pending_writes;
+bool writes_pending = false;
 
-Tweet::~Tweet()
-{
-	// undo changes to cell
-	auto &tweets_by_word = Cell::cells[x][y].tweets_by_word;
-	for (const auto &word : words)
-	{
-		tweets_by_word[word].erase(this);
-		if (tweets_by_word[word].empty())
-			tweets_by_word.erase(word);
-	}
-
-	// remove neighbor references to the tweet we are deleting from all neighbors
-	for (const auto &optics_neighbor_pair : optics_neighbors)
-	{
-		auto &optics_neighbor = *(optics_neighbor_pair.second);
-		optics_neighbor.require_update = true;
-		for (const auto &neighbor_pair_of_neighbor : optics_neighbor.optics_neighbors)
-		{
-			if (neighbor_pair_of_neighbor.second == this)
-			{
-				// we have to make sure we don't accidentally delete different pairs with identical keys (possible in multimap)
-				// (C) guy on S/O: http://stackoverflow.com/questions/3952476/how-to-remove-a-specific-pair-from-a-c-multimap
-				typedef multimap<double, Tweet*>::iterator iterator;
-				std::pair<iterator, iterator> iterpair = optics_neighbor.optics_neighbors.equal_range(neighbor_pair_of_neighbor.first);
-				for (iterator it = iterpair.first; it != iterpair.second; ++it)
-				{
-					if (it->second == this)
-					{
-						optics_neighbor.optics_neighbors.erase(it);
-						break;
-					}
-				}
-			}
-		}
-	}
-}
+vector<Tweet*> cluster_cores;
+Tweet* Tweet::delimiter;
+unsigned int Tweet::variant_count = 0;
 
 int main()
 {
 	TimeKeeper profiler;
-	deque<Tweet*> tweets;
 
 	profiler.start("Initialize");
 	Initialize();
+	Window tweets(PERIOD);
+	profiler.start("restoreSnapshot");
+	restoreSnapshot(tweets);
+	profiler.stop();
 
+	unsigned int periods_since_snapshot = 0;
+	bool degraded = false;
 	while (1)
 	{
-		if (time(0) - last_runtime > PERIOD)
+		// nothing happens until the period is over, pushed tweets queue up in the meantime
+		scheduler->wait(last_runtime);
+		const auto plan = scheduler->plan(last_runtime);
+		if (plan.degraded != degraded)
+		{
+			degraded = plan.degraded;
+			cout << (degraded ? "Behind" : "Caught up") << " by " << plan.lag << "s, "
+				<< (degraded ? "degrading until periods keep up again" : "running in full again") << endl;
+		}
+		periods_degraded += plan.degraded;
+		metrics.set("pericog_lag_seconds", "How long after it was due the last period started.", plan.lag);
+		metrics.set("pericog_degraded", "Whether the last period ran degraded.", plan.degraded);
+
+		profiler.stop();
+		const auto period_start = chrono::steady_clock::now();
+		updateTweets(tweets, plan.degraded ? CANDIDATE_CAP : 0);
+		for (auto variant = 0u; plan.extract && variant < variants.size(); ++variant)
 		{
-			profiler.stop();
-			updateTweets(tweets);
 			profiler.start("getClusters");
-			auto clusters = getClusters(tweets);
+			auto clusters = getClusters(tweets, variant);
 			profiler.start("writeClusters");
-			writeClusters(clusters);
-			profiler.start("updateLastRun");
-			updateLastRun();
-			profiler.stop();
-			cout << "Tweets: " << tweets.size() << endl;
-			cout << "Time: " << last_runtime << endl;
+			writeClusters(clusters, variant);
+			metrics.set("pericog_clusters", "Clusters found in the last period.", clusters.size(),
+				variant ? "variant=\"" + variants[variant].name + "\"" : "");
 		}
-		usleep(10);
+		extractions_skipped += !plan.extract;
+		if (writer && plan.extract)
+			submitWrites();
+		profiler.start("updateLastRun");
+		updateLastRun();
+		if (SNAPSHOT_INTERVAL && ++periods_since_snapshot >= SNAPSHOT_INTERVAL)
+		{
+			profiler.start("saveSnapshot");
+			TMSnapshot::save(SNAPSHOT_PATH, tweets, cluster_cores, VECTOR_SIZE,
+				TMSnapshot::State{last_runtime, tweet_sequence, NEIGHBOR_EPSILON, EPSILON, MIN_PTS});
+			periods_since_snapshot = 0;
+		}
+		profiler.stop();
+		cout << "Tweets: " << tweets.size() << endl;
+		cout << "Time: " << last_runtime << endl;
+
+		metrics.observe("pericog_period_seconds", "Time taken by a whole period.",
+			chrono::duration<double>(chrono::steady_clock::now() - period_start).count());
+		metrics.set("pericog_window_tweets", "Tweets in the clustering window.", tweets.size());
+		metrics.set("pericog_dictionary_words", "Distinct words seen since startup.", dictionary.size());
+		metrics.set("pericog_grid_cells", "Grid cells holding tweets.", grid->getAllocated());
+		metrics.set("pericog_last_run_timestamp_seconds", "Unix time the next period starts from.", last_runtime);
+		if (ingest)
+		{
+			metrics.set("pericog_ingest_pending", "Records queued on the ingest socket or read ahead from tweet_vectors.", ingest->pending());
+			ingest_rejected = ingest->getRejected();
+		}
+		if (!METRICS_PATH.empty())
+			metrics.write(METRICS_PATH);
 	}
 }
 
@@ -98,57 +132,145 @@ void Initialize()
 {
 	getArg(THREAD_COUNT,         "optimization", "thread_count");
 	getArg(BATCH_SIZE,           "optimization", "pericog_batch_size");
+	getArg(WINDOW_LAYOUT,        "optimization", "window_layout");
+	getArg(CLUSTER_EXTRACTION,   "optimization", "cluster_extraction");
+	getArg(PERIOD_EXECUTION,     "optimization", "period_execution");
 	getArg(RECALL_SCOPE,         "timing",       "history");
 	getArg(PERIOD,               "timing",       "period");
 	getArg(last_runtime,         "timing",       "start");
 	getArg(CELL_SIZE,            "grid",         "cell_size");
 	getArg(MAX_SPACIAL_DISTANCE, "grid",         "regional_radius");
+	getArg(REGION,               "grid",         "region");
+	getArg(WEST,                 "grid",         "west");
+	getArg(EAST,                 "grid",         "east");
+	getArg(SOUTH,                "grid",         "south");
+	getArg(NORTH,                "grid",         "north");
 	getArg(EPSILON,              "optics",       "epsilon");
 	getArg(MIN_PTS,              "optics",       "minimum_points");
 	getArg(REACHABILITY_MAXIMUM, "optics",       "reachability_max");
 	getArg(REACHABILITY_MINIMUM, "optics",       "reachability_min");
+	getArg(INDEX,                "optics",       "index");
+	getArg(QUANTIZATION,         "optics",       "quantization");
+	getArg(VARIANT_SECTIONS,     "variants",     "sections");
 	getArg(ACTIVE_ZONE,          "connections",  "active");
 	getArg(TARGET_IP,            "connections",  ACTIVE_ZONE);
-	getArg(VECTOR_SIZE,          "tweet2vec",    "vector_size");
+	getArg(VECTOR_SIZE,          "tokens2vec",   "vector_size");
+	getArg(INGEST_SOURCE,        "ingest",       "source");
+	getArg(VECTOR_FORMAT,        "ingest",       "vector_format");
+	getArg(INGEST_CAPACITY,      "ingest",       "queue_capacity");
+	getArg(SNAPSHOT_PATH,        "snapshot",     "path");
+	getArg(SNAPSHOT_INTERVAL,    "snapshot",     "interval");
+	getArg(METRICS_PATH,         "metrics",      "path");
+	getArg(LOG_LEVEL,            "metrics",      "log_level");
+	getArg(SHARD_COLUMNS,        "sharding",     "columns");
+	getArg(SHARD_ROWS,           "sharding",     "rows");
+	getArg(SHARD_THREADS,        "sharding",     "thread_count");
+	getArg(DEGRADE_LAG,          "scheduler",    "degrade_lag");
+	getArg(RECOVER_LAG,          "scheduler",    "recover_lag");
+	getArg(CANDIDATE_CAP,        "scheduler",    "candidate_cap");
+	getArg(MAX_SKIPPED,          "scheduler",    "max_skipped");
+
+	assert(LOG_LEVEL == "info" || LOG_LEVEL == "debug");
+	TimeKeeper::metrics = &metrics;
+	TimeKeeper::verbose = LOG_LEVEL == "debug";
+
+	assert(REGION == "circle" || REGION == "square");
+	assert(WINDOW_LAYOUT == "morton" || WINDOW_LAYOUT == "arrival");
+	assert(CLUSTER_EXTRACTION == "parallel" || CLUSTER_EXTRACTION == "serial");
+	assert(PERIOD_EXECUTION == "pipelined" || PERIOD_EXECUTION == "sequential");
+	assert(RECOVER_LAG <= DEGRADE_LAG);
+	scheduler = new PeriodScheduler(PERIOD, DEGRADE_LAG, RECOVER_LAG, MAX_SKIPPED);
+
+	// neighbor lists reach the largest epsilon of all, every parameter set reads as far into them as its own
+	variants.push_back(Variant{"", OpticsParameters{EPSILON, MIN_PTS}, REACHABILITY_MINIMUM, REACHABILITY_MAXIMUM,
+		"events", "event_tweets", nullptr});
+	istringstream variant_sections(VARIANT_SECTIONS);
+	for (string section; variant_sections >> section; )
+	{
+		Variant variant{section, OpticsParameters{0, 0}, 0, 0, "", "", nullptr};
+		getArg(variant.optics.epsilon,          section, "epsilon");
+		getArg(variant.optics.minimum_points,   section, "minimum_points");
+		getArg(variant.reachability_maximum,    section, "reachability_max");
+		getArg(variant.reachability_minimum,    section, "reachability_min");
+		getArg(variant.events_table,            section, "events_table");
+		getArg(variant.event_tweets_table,      section, "event_tweets_table");
+		assert(variant.optics.minimum_points);
+		variants.push_back(variant);
+	}
+	Tweet::variant_count = variants.size() - 1;
+	NEIGHBOR_EPSILON = 0;
+	for (const auto &variant : variants)
+		NEIGHBOR_EPSILON = max(NEIGHBOR_EPSILON, variant.optics.epsilon);
+	if (Tweet::variant_count)
+		cout << "Clustering " << variants.size() << " parameter sets, neighbors within " << NEIGHBOR_EPSILON << endl;
+
+	grid = new CellGrid(WEST, EAST, SOUTH, NORTH, CELL_SIZE, MAX_SPACIAL_DISTANCE, REGION == "circle");
+
+	const char *kernel_name;
+	dotProduct = TMDistance::selectDotProduct(VECTOR_SIZE, &kernel_name);
+	cout << "Distance kernel: " << kernel_name << endl;
+	if (QUANTIZATION == "int8")
+	{
+		quantizedDotProduct = TMDistance::selectQuantizedDotProduct(VECTOR_SIZE, &kernel_name);
+		quantizedDotProductBlock = TMDistance::selectQuantizedDotProductBlock(VECTOR_SIZE);
+		cout << "Screening kernel: " << kernel_name << endl;
+	}
+	else
+	{
+		assert(QUANTIZATION == "none");
+		dotProductBlock = TMDistance::selectDotProductBlock(VECTOR_SIZE);
+	}
 
-	// generate grid
-	int x = 0, y;
-	Cell::cells.resize((MAX_DEGREES_LONGITUDE*2)/CELL_SIZE);
-	for (auto &column : Cell::cells)
+	if (INDEX == "lsh")
 	{
-		y = 0;
-		column.resize((MAX_DEGREES_LATITUDE*2)/CELL_SIZE);
-		for (auto &cell : column)
-		{
-			cell.x = x;
-			cell.y = y;
-			y++;
-		}
-		x++;
+		getArg(LSH_TABLES, "optics", "lsh_tables");
+		getArg(LSH_BITS,   "optics", "lsh_bits");
+		neighbor_index = new LshIndex(*grid, dotProduct, VECTOR_SIZE, LSH_TABLES, LSH_BITS);
+	}
+	else
+	{
+		assert(INDEX == "words");
+		neighbor_index = new WordIndex(*grid);
 	}
 
-	Tweet::delimiter = new Tweet();
-	Tweet::delimiter->smallest_reachability_distance = REACHABILITY_MAXIMUM + 1;
+	assert(SHARD_COLUMNS && SHARD_ROWS);
+	if (SHARD_COLUMNS * SHARD_ROWS > 1)
+	{
+		// the workers search with this process's index and kernels, then never come back from serving
+		shards = new TMShards::Coordinator(*grid, SHARD_COLUMNS, SHARD_ROWS, VECTOR_SIZE, [](int socket, unsigned int) {
+			pool = new ThreadPool(SHARD_THREADS);
+			TMShards::Worker(socket, *neighbor_index, *pool, dotProduct, quantizedDotProduct, dotProductBlock, quantizedDotProductBlock,
+				VECTOR_SIZE, NEIGHBOR_EPSILON, PERIOD, WINDOW_LAYOUT == "morton").run();
+		});
+		delete neighbor_index;
+		neighbor_index = nullptr;
+		cout << "Searching " << SHARD_COLUMNS * SHARD_ROWS << " tiles in worker processes" << endl;
+	}
+	pool = new ThreadPool(THREAD_COUNT);
 
-	// TODO: make this not square
-	const auto RADIUS = MAX_SPACIAL_DISTANCE/CELL_SIZE;
-	for (auto &column : Cell::cells)
+	if (INGEST_SOURCE == "socket")
 	{
-		for (auto &cell : column)
+		getArg(INGEST_SOCKET, "ingest", "socket");
+		auto socket = new IngestSocket(INGEST_SOCKET, VECTOR_SIZE, INGEST_CAPACITY);
+		if (socket->isOpen())
 		{
-			for (auto i = floor(cell.x-RADIUS); i <= ceil(cell.x+RADIUS); i++)
-			{
-				for (auto j = floor(cell.y-RADIUS); j <= ceil(cell.y+RADIUS); j++)
-				{
-					// regions end at the poles and the international date line
-					if (i >= Cell::cells.size() || j >= Cell::cells[0].size())
-						continue;
-
-					cell.region.push_back(&(Cell::cells[i][j]));
-				}
-			}
+			ingest = socket;
 		}
+		else
+		{
+			cerr << "Falling back to polling tweet_vectors" << endl;
+			delete socket;
+		}
+	}
+	else
+	{
+		assert(INGEST_SOURCE == "mysql");
 	}
+	assert(VECTOR_FORMAT == "json" || VECTOR_FORMAT == "blob");
+
+	Tweet::delimiter = new Tweet();
+	for (auto variant = 0u; variant < variants.size(); ++variant)
+		Tweet::delimiter->smallestReachabilityDistance(variant) = variants[variant].reachability_maximum + 1;
 
 	ifstream passwordFile("/srv/auth/mysql/pericog.pw");
 	auto password = static_cast<ostringstream&>(ostringstream{} << passwordFile.rdbuf()).str();
@@ -156,397 +278,471 @@ void Initialize()
 	local_connection->setSchema("ThisMinute");
 	tweets_connection = get_driver_instance()->connect("tcp://" +TARGET_IP+ ":3306", "pericog", password);
 	tweets_connection->setSchema("ThisMinute");
+	for (auto variant = 0u; variant < variants.size(); ++variant)
+	{
+		variants[variant].event_writer = new EventWriter(local_connection, variant,
+			variants[variant].events_table, variants[variant].event_tweets_table);
+	}
+
+	// the writer takes local_connection over, the poller reads tweet_vectors on a connection of its own
+	if (PERIOD_EXECUTION == "pipelined")
+	{
+		writer = new PipelineStage();
+		filling_writes.resize(variants.size());
+		pending_writes.resize(variants.size());
+		if (!ingest)
+		{
+			auto poll_connection = get_driver_instance()->connect("tcp://127.0.0.1:3306", "pericog", password);
+			poll_connection->setSchema("ThisMinute");
+			ingest = new TablePoller(poll_connection, [](const string &vector) {
+				return VECTOR_FORMAT == "blob"
+					? TMUtil::parseBlobVector(vector, VECTOR_SIZE)
+					: TMUtil::parseJSONVector(vector, VECTOR_SIZE);
+			}, INGEST_CAPACITY);
+		}
+	}
 
 	unique_ptr<sql::ResultSet> db_cluster_cores(local_connection->createStatement()->executeQuery(
 			"SELECT * FROM core_tweet_vectors"
 		));
 
 
-	while (db_cluster_cores->next())
+	vector<string> columns;
+	for (auto i = 0u; i < VECTOR_SIZE; ++i)
 	{
-		vector<double> feature_vector;
-		feature_vector.reserve(VECTOR_SIZE);
+		columns.push_back("v" + to_string(i));
+	}
 
+	while (db_cluster_cores->next())
+	{
+		vector<double> feature_vector(VECTOR_SIZE);
 		for (auto i = 0u; i < VECTOR_SIZE; ++i)
 		{
-			feature_vector.push_back(stod(db_cluster_cores->getString("v" + to_string(i))));
+			feature_vector[i] = db_cluster_cores->getDouble(columns[i]);
 		}
 
 		cluster_cores.push_back(new Tweet(feature_vector));
+		cluster_cores.back()->sequence = ++tweet_sequence;
+		if (quantizedDotProduct)
+			cluster_cores.back()->quantize(VECTOR_SIZE);
 	}
+	if (shards)
+		shards->setCores(cluster_cores);
 }
 
-void updateTweets(deque<Tweet*> &tweets)
+void updateTweets(Window &tweets, unsigned int candidate_cap)
 {
 	TimeKeeper profiler;
 	profiler.start("Tweet2Vec");
 
 	// delete tweets too old to be related to new tweets, and all references to them
-	while (tweets.size())
-	{
-		Tweet* &tweet = tweets.at(0);
-
-		// the first tweet in tweets is always the oldest, so if it isn't old enough to be deleted, neither are any of the others
-		if (last_runtime - tweet->time < RECALL_SCOPE)
-			break;
-
-		delete tweets.at(0);
-		tweets.pop_front();
-	}
+	expireTweets(tweets);
 
+	// pushed or read-ahead tweets are taken up to what was queued when the period ended, so busy producers cannot hold it open
+	size_t backlog = ingest ? ingest->pending() : 0;
 	while (true)
 	{
-		usleep(5000);
-		unique_ptr<sql::ResultSet> db_continue(local_connection->createStatement()->executeQuery(
-				"SELECT COUNT(*) AS pending FROM tweet_vectors"
-			));
-		db_continue->next();
-		if (!stoi(db_continue->getString("pending")))
+		vector<Tweet*> new_tweets;
+		if (ingest)
+		{
+			if (!backlog)
+				break;
+			backlog -= receiveTweets(tweets, new_tweets, min<size_t>(backlog, max(BATCH_SIZE, 1u)));
+		}
+		else if (!pollTweets(tweets, new_tweets))
 			break;
+		tweets_received += new_tweets.size();
 
-		unique_ptr<sql::ResultSet> db_tweets(local_connection->createStatement()->executeQuery(
-				"SELECT *, UNIX_TIMESTAMP(time) AS unix_time FROM tweet_vectors WHERE status = 0"
-			));
-
-		vector<Tweet*> new_tweets;
-		string updated_tweet_ids = "";
-		while (db_tweets->next())
+		// every pair of tweets within the batch is measured exactly once, by whichever of the two came later
+		for (const auto &new_tweet : new_tweets)
 		{
-			new_tweets.push_back(new Tweet(
-					stoi(db_tweets->getString("unix_time")),
-					stod(db_tweets->getString("lat")),
-					stod(db_tweets->getString("lon")),
-					db_tweets->getString("text"),
-					TMUtil::parseJSONVector(db_tweets->getString("vector"), VECTOR_SIZE)
-				));
-
-			updated_tweet_ids += db_tweets->getString("id") + ",";
+			new_tweet->sequence = ++tweet_sequence;
 		}
 
-		mutex input_lock, data_lock;
-		auto processTweets = [&]() {
-			while (true)
+		struct Link
+		{
+			Tweet* tweet;
+			Neighbor neighbor;
+		};
+		// back references from existing tweets to new ones, bucketed by the worker that found them and the worker that will apply them
+		vector<vector<vector<Link>>> links(pool->size(), vector<vector<Link>>(pool->size()));
+
+		auto indexTweets = [&](size_t begin, size_t end, unsigned int) {
+			for (auto i = begin; i < end; ++i)
 			{
-				input_lock.lock();
-				if (new_tweets.empty())
+				Tweet* &new_tweet = new_tweets[i];
+				new_tweet->clean(dictionary, CELL_SIZE);
+
+				// ignore tweets consisting only of stopwords or other ignored strings, and tweets from outside the grid
+				if (!new_tweet->words.size() || !grid->contains(new_tweet))
 				{
-					input_lock.unlock();
-					return;
+					tweets.discard(new_tweet);
+					new_tweet = nullptr;
+					tweets_discarded++;
+					continue;
 				}
-				Tweet* new_tweet = new_tweets.back();
-				new_tweets.pop_back();
-				input_lock.unlock();
 
-				new_tweet->clean();
+				// with shards, the workers index the tweets and search them
+				if (shards)
+					continue;
+				neighbor_index->insert(new_tweet);
+				if (quantizedDotProduct)
+					new_tweet->quantize(VECTOR_SIZE);
+			}
+		};
 
-				// ignore tweets consisting only of stopwords or other ignored strings
-				if (!new_tweet->words.size())
-				{
-					delete new_tweet;
+		// the index is only read from here on, so workers search it without any locking
+		auto findNeighbors = [&](size_t begin, size_t end, unsigned int worker) {
+			SearchCounts counts;
+			uint64_t linked = 0;
+			vector<Tweet*> candidates;
+
+			// every new tweet is measured against every core, so those distances, or the screen's dot products, are
+			// computed for the chunk at once
+			CoreDistances core_distances(cluster_cores, dotProduct, dotProductBlock, quantizedDotProductBlock, VECTOR_SIZE);
+			core_distances.compute(&new_tweets[begin], end - begin);
+			for (auto i = begin; i < end; ++i)
+			{
+				Tweet* new_tweet = new_tweets[i];
+				if (!new_tweet)
 					continue;
-				}
 
-				for (const auto &core_tweet : cluster_cores)
-				{
-					new_tweet->optics_distances[core_tweet] = 0;
-				}
+				searchNeighbors(new_tweet, i - begin, candidates, core_distances, *neighbor_index, cluster_cores, dotProduct,
+					quantizedDotProduct, VECTOR_SIZE, NEIGHBOR_EPSILON, candidate_cap, new_tweet->optics_neighbors, counts);
+				for (const auto &neighbor : new_tweet->optics_neighbors)
+					links[worker][getPartition(neighbor.tweet)].push_back(Link{neighbor.tweet, Neighbor{new_tweet, neighbor.distance}});
+				linked += new_tweet->optics_neighbors.size();
 
-				data_lock.lock();
-				for (const auto &word : new_tweet->words)
-				{
-					for (const auto &cell : Cell::cells[new_tweet->x][new_tweet->y].region)
-					{
-						if (!(cell->tweets_by_word.count(word)))
-							continue;
-
-						for (const auto &tweet : cell->tweets_by_word.at(word))
-						{
-							if (new_tweet->optics_distances.count(tweet))
-								continue;
-
-							new_tweet->optics_distances[tweet] = 0;
-						}
-					}
-				}
+				new_tweet->sortNeighbors();
+			}
 
-				for (const auto &word : new_tweet->words)
-				{
-					Cell::cells[new_tweet->x][new_tweet->y].tweets_by_word[word].insert(new_tweet);
-				}
-				data_lock.unlock();
+			// counted per chunk, so workers share the counters once per chunk rather than once per pair
+			candidates_examined += counts.examined;
+			candidates_capped += counts.capped;
+			distances_screened += counts.screened;
+			distances_computed += counts.computed;
+			neighbors_linked += linked;
+		};
 
-				for (auto &neighbor_pair : new_tweet->optics_distances)
-				{
-					neighbor_pair.second = getDistance(neighbor_pair.first->feature_vector, new_tweet->feature_vector);
-				}
+		// neighbors the shards found, linked as findNeighbors links them
+		vector<vector<Neighbor>> found_neighbors;
+		auto linkFoundNeighbors = [&](size_t begin, size_t end, unsigned int worker) {
+			uint64_t linked = 0;
+			for (auto i = begin; i < end; ++i)
+			{
+				Tweet* new_tweet = new_tweets[i];
+				if (!new_tweet)
+					continue;
+
+				new_tweet->optics_neighbors.swap(found_neighbors[i]);
+				for (const auto &neighbor : new_tweet->optics_neighbors)
+					links[worker][getPartition(neighbor.tweet)].push_back(Link{neighbor.tweet, Neighbor{new_tweet, neighbor.distance}});
+				linked += new_tweet->optics_neighbors.size();
+
+				new_tweet->sortNeighbors();
+			}
+			neighbors_linked += linked;
+		};
 
-				data_lock.lock();
-				for (const auto &neighbor_pair : new_tweet->optics_distances)
+		// each worker owns the existing tweets in its partition, so back references are added without contention
+		vector<vector<Tweet*>> linked_tweets_by_partition(pool->size());
+		auto linkNeighbors = [&](size_t partition, size_t, unsigned int) {
+			auto &linked_tweets = linked_tweets_by_partition[partition];
+			for (const auto &worker_links : links)
+			{
+				for (const auto &link : worker_links[partition])
 				{
-					const auto &tweet = neighbor_pair.first;
-					const double &optics_distance = new_tweet->optics_distances[tweet] = tweet->optics_distances[new_tweet] = neighbor_pair.second;
-
-					// add neighbor references between the new tweet and all its neighbors
-					if (optics_distance <= EPSILON)
-					{
-						new_tweet->optics_neighbors.insert(make_pair(optics_distance, tweet));
-						tweet->optics_neighbors.insert(make_pair(optics_distance, new_tweet));
-						tweet->require_update = true;
-					}
+					link.tweet->optics_neighbors.push_back(link.neighbor);
+					linked_tweets.push_back(link.tweet);
 				}
+			}
 
-				tweets.push_back(new_tweet);
-				data_lock.unlock();
+			sort(linked_tweets.begin(), linked_tweets.end());
+			linked_tweets.erase(unique(linked_tweets.begin(), linked_tweets.end()), linked_tweets.end());
+			for (const auto &tweet : linked_tweets)
+			{
+				tweet->sortNeighbors();
 			}
 		};
 
-		if (!updated_tweet_ids.empty())
+		if (!new_tweets.empty())
 		{
-			updated_tweet_ids.pop_back(); // take the extra comma out
-			local_connection->createStatement()->execute(
-					"UPDATE tweet_vectors SET status = 1 WHERE tweet_id IN (" +updated_tweet_ids+ ")"
-				);
-			vector<thread> threads;
-
 			profiler.start("processTweets");
-			for (auto i = 0u; i < THREAD_COUNT; i++)
-				threads.emplace_back(processTweets);
-
-			for (auto i = 0u; i < THREAD_COUNT; i++)
-				threads[i].join();
-		}
-	}
-
-	tweets.shrink_to_fit();
-
-	// calculate core distances
-	for (const auto &tweet : tweets)
-	{
-		if (tweet->require_update)
-		{
-			// non-core objects (borders and noise) are denoted by a core distance greater than epsilon
-			if (tweet->optics_neighbors.size() < MIN_PTS)
+			pool->parallelFor(new_tweets.size(), 64, indexTweets);
+			if (shards)
 			{
-				tweet->core_distance = EPSILON + 1;
-				continue;
+				const auto counts = shards->search(new_tweets, found_neighbors, candidate_cap);
+				candidates_examined += counts.examined;
+				candidates_capped += counts.capped;
+				distances_screened += counts.screened;
+				distances_computed += counts.computed;
+				pool->parallelFor(new_tweets.size(), 64, linkFoundNeighbors);
 			}
-
-			auto iterator = tweet->optics_neighbors.begin();
-			advance(iterator, MIN_PTS-1);
-			tweet->core_distance = iterator->first;
-		}
-	}
-
-	// calculate smallest reachability distances
-	for (const auto &tweet : tweets)
-	{
-		if (tweet->require_update)
-		{
-			// noise is denoted by a smallest reachability distance greater than epsilon
-			tweet->smallest_reachability_distance = EPSILON + 1;
-
-			for (const auto &optics_neighbor_pair : tweet->optics_neighbors)
+			else
 			{
-				const auto &optics_neighbor = optics_neighbor_pair.second;
+				pool->parallelFor(new_tweets.size(), 16, findNeighbors);
+			}
+			pool->parallelFor(pool->size(), 1, linkNeighbors);
 
-				// tweet cannot be directly density-reachable from a non-core object
-				if (optics_neighbor->core_distance > EPSILON)
+			for (const auto &new_tweet : new_tweets)
+			{
+				if (!new_tweet)
 					continue;
 
-				double reachability_distance;
-				if (tweet->optics_distances.at(optics_neighbor) > optics_neighbor->core_distance)
-					reachability_distance = tweet->optics_distances.at(optics_neighbor);
-				else
-					reachability_distance = tweet->core_distance;
-
-				if (tweet->smallest_reachability_distance > reachability_distance)
-					tweet->smallest_reachability_distance = reachability_distance;
+				tweets.insert(new_tweet);
+				optics_updater.touch(new_tweet);
 			}
 
-			tweet->require_update = false;
+			for (const auto &linked_tweets : linked_tweets_by_partition)
+			{
+				for (const auto &tweet : linked_tweets)
+				{
+					optics_updater.touch(tweet);
+				}
+			}
 		}
 	}
+
+	profiler.start("updateOptics");
+	vector<OpticsParameters> parameters;
+	for (const auto &variant : variants)
+		parameters.push_back(variant.optics);
+	optics_updater.update(*pool, parameters);
+
+	// periods that are over get no more tweets, so they are packed for the scans of the periods to come
+	if (WINDOW_LAYOUT == "morton")
+	{
+		profiler.start("sealWindow");
+		const auto moved = tweets.seal(last_runtime, VECTOR_SIZE);
+		if (shards)
+			shards->seal(last_runtime, moved);
+		else
+			neighbor_index->relocate(moved);
+	}
 	profiler.stop();
 }
 
-vector<vector<Tweet*>> getClusters(const deque<Tweet*> &tweets)
+bool pollTweets(Window &tweets, vector<Tweet*> &new_tweets)
 {
-	// construct a container of all non-noise tweets for processing
-	unordered_set<Tweet*> tweets_to_process;
-	for (const auto &tweet : tweets)
-	{
-		if (tweet->smallest_reachability_distance > EPSILON)
-			continue;
-
-		tweets_to_process.insert(tweet);
-	}
+	usleep(5000);
+	unique_ptr<sql::ResultSet> db_continue(local_connection->createStatement()->executeQuery(
+			"SELECT COUNT(*) AS pending FROM tweet_vectors"
+		));
+	db_continue->next();
+	if (!stoi(db_continue->getString("pending")))
+		return false;
 
-	vector<Tweet*> reachability_plot;
-	reachability_plot.reserve(tweets_to_process.size());
+	unique_ptr<sql::ResultSet> db_tweets(local_connection->createStatement()->executeQuery(
+			"SELECT *, UNIX_TIMESTAMP(time) AS unix_time FROM tweet_vectors WHERE status = 0"
+		));
 
-	priority_queue<pair<double, Tweet*>, deque<pair<double, Tweet*>>> nodes;
+	// rows are read off the connection serially, the parsing is spread over the pool
+	struct Row
+	{
+		string time, lat, lon, text, user, vector;
+	};
+	vector<Row> rows;
+	string updated_tweet_ids = "";
+	while (db_tweets->next())
+	{
+		rows.push_back(Row{
+				db_tweets->getString("unix_time"),
+				db_tweets->getString("lat"),
+				db_tweets->getString("lon"),
+				db_tweets->getString("text"),
+				db_tweets->getString("user"),
+				db_tweets->getString("vector")
+			});
+
+		updated_tweet_ids += db_tweets->getString("id") + ",";
+	}
 
-	for (const auto &seed : cluster_cores)
+	if (!updated_tweet_ids.empty())
 	{
-		reachability_plot.push_back(Tweet::delimiter);
+		updated_tweet_ids.pop_back(); // take the extra comma out
+		local_connection->createStatement()->execute(
+				"UPDATE tweet_vectors SET status = 1 WHERE tweet_id IN (" +updated_tweet_ids+ ")"
+			);
+	}
 
-		// process the tree of nodes connected to the seed node in order of reachability
-		nodes.push(make_pair(0, seed));
-		while (!nodes.empty())
+	// a row that does not parse is counted and left out, as the poller does, rather than throwing out of the pool
+	new_tweets.assign(rows.size(), nullptr);
+	pool->parallelFor(rows.size(), 64, [&](size_t begin, size_t end, unsigned int) {
+		for (auto i = begin; i < end; ++i)
 		{
-			const auto &tweet = nodes.top().second;
-			nodes.pop();
-			reachability_plot.push_back(tweet);
-
-			// acquire, but do not branch through border objects
-			if (tweet->core_distance > EPSILON)
-				continue;
-
-			for (const auto &pair : tweet->optics_neighbors)
+			int time;
+			double lat, lon;
+			vector<double> feature_vector;
+			try
 			{
-				const auto &optics_neighbor = pair.second;
-				if (!tweets_to_process.count(optics_neighbor))
-					continue;
-				cout << optics_neighbor->text << endl;
-				nodes.push(make_pair(optics_neighbor->smallest_reachability_distance, optics_neighbor));
-				tweets_to_process.erase(optics_neighbor);
+				time = stoi(rows[i].time);
+				lat = stod(rows[i].lat);
+				lon = stod(rows[i].lon);
+				feature_vector = VECTOR_FORMAT == "blob"
+					? TMUtil::parseBlobVector(rows[i].vector, VECTOR_SIZE)
+					: TMUtil::parseJSONVector(rows[i].vector, VECTOR_SIZE);
+			}
+			catch (logic_error &)
+			{
+				ingest_rejected++;
+				continue;
 			}
+			new_tweets[i] = tweets.create(time, lat, lon, rows[i].text, move(feature_vector));
+			new_tweets[i]->user = rows[i].user;
 		}
-	}
+	});
+	new_tweets.erase(remove(new_tweets.begin(), new_tweets.end(), nullptr), new_tweets.end());
 
-	vector<vector<Tweet*>> clusters;
-	bool in_cluster = false;
-	vector<Tweet*>::iterator cluster_start;
-	for (auto i = reachability_plot.begin(); i != reachability_plot.end(); i++)
-	{
-		if (!(*i)->time)
-			continue;
+	return true;
+}
+
+size_t receiveTweets(Window &tweets, vector<Tweet*> &new_tweets, size_t limit)
+{
+	// records arrive already parsed, so all that is left is to place them in the window
+	vector<IngestQueue::Record> records;
+	ingest->take(records, limit);
 
-		if (!in_cluster
-		&& (*i)->smallest_reachability_distance <= REACHABILITY_MAXIMUM
-		&& (*i)->smallest_reachability_distance >= REACHABILITY_MINIMUM)
+	new_tweets.resize(records.size());
+	pool->parallelFor(records.size(), 64, [&](size_t begin, size_t end, unsigned int) {
+		for (auto i = begin; i < end; ++i)
 		{
-			cluster_start = i;
-			in_cluster = true;
+			auto &record = records[i];
+			new_tweets[i] = tweets.create(record.time, record.lat, record.lon, record.text, move(record.feature_vector));
+			new_tweets[i]->user = move(record.user);
 		}
-		else if (in_cluster
-		&& ((*i)->smallest_reachability_distance > REACHABILITY_MAXIMUM ||
-			(*i)->smallest_reachability_distance < REACHABILITY_MINIMUM))
+	});
+
+	return records.size();
+}
+
+void restoreSnapshot(Window &tweets)
+{
+	TMSnapshot::State state;
+	state.epsilon = NEIGHBOR_EPSILON;
+	state.optics_epsilon = EPSILON;
+	state.minimum_points = MIN_PTS;
+	vector<Tweet*> restored_tweets;
+	if (!TMSnapshot::load(SNAPSHOT_PATH, tweets, cluster_cores, VECTOR_SIZE, state, restored_tweets))
+		return;
+
+	// neighbors and distances come back as they were, only words, cells and the index are rebuilt
+	pool->parallelFor(restored_tweets.size(), 64, [&](size_t begin, size_t end, unsigned int) {
+		for (auto i = begin; i < end; ++i)
 		{
-			vector<Tweet*> cluster(cluster_start, i);
-			in_cluster = false;
-			if (cluster.size() > MIN_TWEETS)
-			{
-				const string &first_user = cluster[0]->user;
-				for (const auto &tweet : cluster)
-				{
-					if (tweet->time
-					&& tweet->user != first_user)
-					{
-						clusters.push_back(cluster);
-						break;
-					}
-				}
-			}
+			restored_tweets[i]->clean(dictionary, CELL_SIZE);
+			if (shards)
+				continue;
+			neighbor_index->insert(restored_tweets[i]);
+			if (quantizedDotProduct)
+				restored_tweets[i]->quantize(VECTOR_SIZE);
 		}
+	});
+	if (shards)
+		shards->insert(restored_tweets);
+
+	// the snapshot only holds the distances of [optics], the next update derives every variant's again
+	if (Tweet::variant_count)
+	{
+		for (const auto &tweet : cluster_cores)
+			optics_updater.touch(tweet);
+		for (const auto &tweet : restored_tweets)
+			optics_updater.touch(tweet);
 	}
 
-	return clusters;
+	last_runtime = state.last_runtime;
+	tweet_sequence = state.tweet_sequence;
+	cout << "Restored " << restored_tweets.size() << " tweets from " << SNAPSHOT_PATH << ", resuming at " << last_runtime << endl;
 }
 
-void writeClusters(vector<vector<Tweet*>> &clusters)
+void expireTweets(Window &tweets)
 {
-	if (clusters.empty())
+	if (last_runtime < RECALL_SCOPE)
 		return;
 
-	local_connection->createStatement()->execute("DROP TABLE IF EXISTS events_new, event_tweets_new");
-	local_connection->createStatement()->execute("CREATE TABLE events_new LIKE events");
-	local_connection->createStatement()->execute("CREATE TABLE event_tweets_new LIKE event_tweets");
+	const auto expired_tweets = tweets.expire(last_runtime - RECALL_SCOPE);
+	tweets_expired += expired_tweets.size();
+	optics_updater.unlink(*pool, expired_tweets);
 
-	// each cluster is an event containing time and location information as well as an id to access all of its child tweets
-	int i = 0;
-	for (const auto &cluster : clusters)
+	if (shards)
 	{
-		double avgX, avgY;
-		avgX = avgY = 0.0;
-		unsigned int start_time, end_time;
-		start_time = end_time = cluster[0]->time;
-		unordered_set<string> users;
-		for (const auto &tweet : cluster)
-		{
-			avgX += tweet->lon;
-			avgY += tweet->lat;
-			if (tweet->time < start_time)
-				start_time = tweet->time;
-			if (tweet->time > end_time)
-				end_time = tweet->time;
-			users.insert(tweet->user);
-		}
-		avgX /= cluster.size();
-		avgY /= cluster.size();
-
-		local_connection->createStatement()->execute(
-			"INSERT INTO events_new (`id`, `lon`, `lat`, `start_time`, `end_time`, `users`) VALUES ("
-					+to_string(i)+ ","
-					+to_string(avgX)+ ","
-					+to_string(avgY)+ ","
-					"FROM_UNIXTIME(" +to_string(start_time)+ "),"
-					"FROM_UNIXTIME(" +to_string(end_time)+ "),"
-					+to_string(users.size())+
-				")");
-
-		string query = "INSERT INTO event_tweets_new (`event_id`, `time`, `lat`, `lon`, `exact`, `text`) VALUES ";
-		for (const auto &tweet : cluster)
-		{
-			string escaped_tweet_text = "";
-			for (auto i = 0u; i < tweet->text.length(); ++i)
+		shards->expire(last_runtime - RECALL_SCOPE, expired_tweets);
+	}
+	else
+	{
+		pool->parallelFor(expired_tweets.size(), 256, [&](size_t begin, size_t end, unsigned int) {
+			for (auto i = begin; i < end; ++i)
 			{
-				if (tweet->text[i] == '\'')
-				{
-					escaped_tweet_text += "''";
-				}
-				else
-				{
-					escaped_tweet_text += tweet->text[i];
-				}
+				neighbor_index->erase(expired_tweets[i]);
 			}
-
-			query +=
-				"( "
-					+to_string(i)+ ","
-					"FROM_UNIXTIME(" +to_string(tweet->time)+ "),"
-					+to_string(avgX)+ ","
-					+to_string(avgY)+ ","
-					+to_string(tweet->exact)+ ","
-					"'" +escaped_tweet_text+ "'"
-				"),";
-		}
-		query.pop_back(); // take the extra comma out
-		local_connection->createStatement()->execute(query);
-
-		i++;
+		});
 	}
 
-	local_connection->createStatement()->execute("DROP TABLE IF EXISTS events_old, event_tweets_old");
-	local_connection->createStatement()->execute(
-			"RENAME TABLE "
-				"events TO events_old,"
-				"event_tweets TO event_tweets_old,"
-				"events_new TO events,"
-				"event_tweets_new TO event_tweets"
-		);
+	// nothing references the expired tweets anymore, so their slices can go
+	tweets.releaseExpired();
 }
 
-double getDistance(const vector<double> &A, const vector<double> &B)
+vector<vector<Tweet*>> getClusters(const Window &tweets, unsigned int variant)
 {
-	double dot = 0.0, denom_a = 0.0, denom_b = 0.0 ;
-	for (auto i = 0u; i < VECTOR_SIZE; ++i)
+	const auto &parameters = variants[variant];
+	return getClusters(tweets, cluster_cores, parameters.optics.epsilon,
+		parameters.reachability_minimum, parameters.reachability_maximum, MIN_TWEETS,
+		CLUSTER_EXTRACTION == "parallel" ? pool : nullptr, variant);
+}
+
+void writeClusters(vector<vector<Tweet*>> &clusters, unsigned int variant)
+{
+	if (!writer)
 	{
-		dot += A[i] * B[i] ;
-		denom_a += A[i] * A[i] ;
-		denom_b += B[i] * B[i] ;
+		reportWrite(variants[variant].event_writer->write(clusters), variant);
+		return;
 	}
-	return 1 - (dot / (sqrt(denom_a) * sqrt(denom_b))) ;
+
+	// ids are assigned against what the tables hold, so the previous period has to be in them first
+	collectWrites();
+	filling_writes[variant] = variants[variant].event_writer->prepare(clusters);
+}
+
+void submitWrites()
+{
+	// the batches hold copies of everything they write, so the window is free to change while they go out
+	swap(filling_writes, pending_writes);
+	writes_pending = true;
+	writer->submit([]() {
+		for (auto variant = 0u; variant < variants.size(); ++variant)
+			variants[variant].event_writer->commit(pending_writes[variant]);
+	});
+}
+
+void collectWrites()
+{
+	if (!writes_pending)
+		return;
+
+	writer->wait();
+	writes_pending = false;
+	for (auto variant = 0u; variant < variants.size(); ++variant)
+		reportWrite(pending_writes[variant].report, variant);
+}
+
+void reportWrite(const EventWriter::Report &report, unsigned int variant)
+{
+	events_written += report.events;
+	events_removed += report.removed;
+	event_write_failures += report.failed;
+	cout << (variant ? variants[variant].name + " events: " : "Events: ") << report.events << " written with " << report.tweets << " tweets, "
+		<< report.removed << " removed, " << report.unchanged << " unchanged in " << report.seconds << "s"
+		<< (report.failed ? " (failed, rolled back)" : "") << endl;
+}
+
+unsigned int getPartition(const Tweet* tweet)
+{
+	// pointers are aligned, so mix the bits before taking the remainder
+	return ((reinterpret_cast<uintptr_t>(tweet) >> 4) * 0x9E3779B97F4A7C15ull >> 32) % pool->size();
+}
+
+double getDistance(const Tweet &A, const Tweet &B)
+{
+	return getDistance(A, B, dotProduct, VECTOR_SIZE);
 }
 
 void updateLastRun()
@@ -2,8 +2,8 @@
 
 #include <string>
 #include <vector>
-#include <regex>
 #include <fstream>
+#include <sstream>
 #include <algorithm>
 #include <map>
 #include <unordered_set>
@@ -16,6 +16,8 @@
 #include <thread>
 #include <chrono>
 #include <mutex>
+#include <atomic>
+#include <functional>
 #include <queue>
 #include <ctime>
 #include <iterator>
@@ -29,32 +31,47 @@
 #include <cppconn/statement.h>
 
 #include "INIReader.h"
+#include "distance.h"
+#include "dictionary.h"
+#include "event_writer.h"
+#include "index.h"
+#include "ingest.h"
+#include "metrics.h"
+#include "thread_pool.h"
+#include "tokenizer.h"
+#include "optics.h"
+#include "pipeline.h"
+#include "scheduler.h"
+#include "shards.h"
+#include "clusters.h"
+#include "snapshot.h"
+#include "table_poller.h"
+#include "window.h"
 #include "timer.h"
 #include "tweet.h"
 #include "util.h"
 
 using namespace std;
 
-struct Cell
-{
-	static vector<vector<Cell>> cells;
-
-	unsigned int x, y;
-	unordered_map<string, unordered_set<Tweet*>> tweets_by_word;
-	vector<Cell*> region;
-};
-
 // utility functions
 unordered_set<string> explode(string const &s);
 string getArg(string section, string option);
 void getArg(unsigned int &arg, string section, string option);
 void getArg(double &arg, string section, string option);
 void getArg(string &arg, string section, string option);
+unsigned int getPartition(const Tweet* tweet);
 
 // core functionality
 void Initialize();
-void updateTweets(deque<Tweet*> &tweets);
-double getDistance(const vector<double> &A, const vector<double> &B);
-vector<vector<Tweet*>> getClusters(const deque<Tweet*> &tweets);
-void writeClusters(vector<vector<Tweet*>> &clusters);
+void updateTweets(Window &tweets, unsigned int candidate_cap);
+bool pollTweets(Window &tweets, vector<Tweet*> &new_tweets);
+size_t receiveTweets(Window &tweets, vector<Tweet*> &new_tweets, size_t limit);
+void restoreSnapshot(Window &tweets);
+void expireTweets(Window &tweets);
+double getDistance(const Tweet &A, const Tweet &B);
+vector<vector<Tweet*>> getClusters(const Window &tweets, unsigned int variant);
+void writeClusters(vector<vector<Tweet*>> &clusters, unsigned int variant);
+void submitWrites();
+void collectWrites();
+void reportWrite(const EventWriter::Report &report, unsigned int variant);
 void updateLastRun();